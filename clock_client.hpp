@@ -0,0 +1,31 @@
+#pragma once
+
+// split from clock_lpc3230.hpp because of cyclic file include problems
+
+#include "armtastic/types.hpp"
+
+namespace lpc3230
+{
+
+namespace clock
+{
+    struct frequencies
+    {
+        u32 arm;
+        u32 h;
+        u32 ddr;
+        u32 periph;
+    };
+}
+
+// drivers deriving a divider from one of the system clocks register with clock::controller::add_client,
+// and are called with interrupts disabled around each frequency change
+struct clock_client
+{
+    // still running at the current frequencies. program settings which are safe at both the current and the next ones.
+    virtual void prepare_frequency_change(const clock::frequencies& current, const clock::frequencies& next) {}
+    // the switch is done : program the exact settings for the new frequencies
+    virtual void frequency_changed(const clock::frequencies& current) = 0;
+};
+
+}
\ No newline at end of file
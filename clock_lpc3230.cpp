@@ -37,14 +37,39 @@ namespace clock
         PWR_CTRL = 0x00000000;
         HCLKPLL_CTRL = 0x00000000;
         SYSCLK_CTRL = 0x00000140;
-        HCLKPLL_CTRL = 0x0001401E;
+        HCLKPLL_CTRL = default_configuration::hclkpll_control;
 
         while (!(HCLKPLL_CTRL & 0x1));
 
-        HCLKDIV_CTRL = 0x000000BD;
+        HCLKDIV_CTRL = default_configuration::hclkdiv_control;
         PWR_CTRL = 0x00000004;
     }
 
+    // raw address : the register objects live in DDR
+    static volatile u32* const high_speed_counter = reinterpret_cast<volatile u32*>(high_speed_timer::base_addr + high_speed_timer::offset::counter);
+
+    void switch_frequency(u32 hclkpll_control, u32 hclkdiv_control, u32 self_refresh_exit_ticks)
+    {
+        // the DDR clock stops in Direct RUN mode : put the DDR in self-refresh first
+        EMCDynamicControl |= 0x00000004;
+        while (!(EMCStatus & 0x00000004));
+
+        PWR_CTRL &= ~0x00000004; // Direct RUN mode, everything runs from sysclk while the PLL is reprogrammed
+
+        HCLKPLL_CTRL = hclkpll_control;
+        while (!(HCLKPLL_CTRL & 0x1)); // await PLL lock down
+
+        HCLKDIV_CTRL = hclkdiv_control;
+        PWR_CTRL |= 0x00000004; // back to RUN mode, on the new PLL output
+
+        EMCDynamicControl &= ~0x00000004; // self-refresh exit, with the timings the EMC got in prepare_frequency_change
+        while (EMCStatus & 0x00000004);
+
+        // no access may reach the DDR before tXSR is over
+        u32 start = *high_speed_counter;
+        while (*high_speed_counter - start < self_refresh_exit_ticks);
+    }
+
 }
 
 }
\ No newline at end of file
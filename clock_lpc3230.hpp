@@ -3,6 +3,9 @@
 #include "armtastic/types.hpp"
 #include "registers_lpc3230.hpp"
 #include "interrupt_lpc3230.hpp"
+#include "clock_client.hpp"
+#include "fixed_ratio.hpp"
+#include "ddr_timing_lpc3230.hpp"
 #include "modules/init/globals.hpp"
 
 typedef u64 us;
@@ -12,32 +15,68 @@ namespace lpc3230
 
 namespace clock
 {
+    // solves the HCLK PLL and divider settings for a set of target frequencies at compile time, and refuses the ones the chip cannot run.
+    // the ARM clock comes from the PLL, directly or through its post divider, the other clocks are integer divisions of it.
+    template <u32 Osc, u32 Arm, u32 H, u32 Ddr, u32 Periph>
+    struct configuration
+    {
+        static const u32 osc_freq = Osc;
+        static const u32 arm_freq = Arm;
+        static const u32 h_freq = H;
+        static const u32 ddr_freq = Ddr;
+        static const u32 periph_freq = Periph;
+
+        static const u32 min_cco_freq = 156000000;
+        static const u32 max_cco_freq = 320000000;
+
+        // smallest post divider (by 2 << (post_shift - 1)) which brings the CCO into its range, 0 for the direct output
+        static const u32 post_shift = (Arm >= min_cco_freq) ? 0 : (Arm * 2 >= min_cco_freq) ? 1 : (Arm * 4 >= min_cco_freq) ? 2 : (Arm * 8 >= min_cco_freq) ? 3 : 4;
+        static const u32 cco_freq = Arm << post_shift;
+        static const u32 multiplier = cco_freq / Osc;
+
+        static const u32 hclk_ratio = Arm / H;
+        static const u32 hclk_code = (hclk_ratio == 1) ? 0 : (hclk_ratio == 2) ? 1 : 2;
+        static const u32 ddram_code = Arm / Ddr; // 1 : DDR at ARM clock, 2 : DDR at half
+        static const u32 periph_ratio = Arm / Periph;
+
+        static const u32 hclkpll_control = 0x00010000 | (post_shift ? ((post_shift - 1) << 11) : 0x00004000) | ((multiplier - 1) << 1); // PLL powered, pre-divider by 1
+        static const u32 hclkdiv_control = (ddram_code << 7) | ((periph_ratio - 1) << 2) | hclk_code;
+
+        BOOST_STATIC_ASSERT(Arm <= 266000000);
+        BOOST_STATIC_ASSERT(cco_freq >= min_cco_freq && cco_freq <= max_cco_freq);
+        BOOST_STATIC_ASSERT(cco_freq % Osc == 0 && multiplier >= 1 && multiplier <= 256); // the PLL only multiplies by an integer
+
+        BOOST_STATIC_ASSERT(H <= 133000000);
+        BOOST_STATIC_ASSERT(Arm % H == 0 && (hclk_ratio == 1 || hclk_ratio == 2 || hclk_ratio == 4));
+
+        BOOST_STATIC_ASSERT(Ddr == 2 * H); // the EMC runs on HCLK, and the DDR must be clocked at twice its rate
+        BOOST_STATIC_ASSERT(Arm % Ddr == 0 && (ddram_code == 1 || ddram_code == 2));
+        BOOST_STATIC_ASSERT(!(ddram_code == 2 && hclk_code == 2)); // known hardware bug, see clock_lpc3230.cpp
+
+        BOOST_STATIC_ASSERT(Periph <= 20000000); // periph must not exceed 20 MHz
+        BOOST_STATIC_ASSERT(Arm % Periph == 0 && periph_ratio >= 1 && periph_ratio <= 32);
+    };
+
+    // 13 MHz oscillator, PLL by 16. periph_clock is kept at the oscillator frequency for Direct RUN mode compatibility
+    typedef configuration<13000000, 208000000, 104000000, 208000000, 13000000> default_configuration;
+
     // initialization for clock is not executed from within the controller as in some scenarios this needs to be run before static objects have been constructed
     void init(u32 osc_clock) __attribute__ ((section (".reset")));
 
+    // reprograms the HCLK PLL and the dividers, going through Direct RUN mode with the DDR in self-refresh.
+    // runs from internal RAM and touches no DDR : call with interrupts disabled and the data cache holding no dirty line it would need to evict.
+    // self_refresh_exit_ticks is tXSR in high speed timer ticks, waited out before returning to code that may touch the DDR.
+    void switch_frequency(u32 hclkpll_control, u32 hclkdiv_control, u32 self_refresh_exit_ticks) __attribute__ ((section (".reset")));
+
     class controller
     {
     public:
-        controller() : sys_freq(0), arm_freq(0), periph_freq(0), h_freq(0), ddr_freq(0), periph_freq_div(0), periph_freq_upscale(0) {}
+        controller() : sys_freq(0), arm_freq(0), periph_freq(0), h_freq(0), ddr_freq(0), client_count(0) {}
     
         void init(u32 osc_freq, u8 int_priority, bool fast_irq)
         {  
             sys_freq = osc_freq;
-            arm_freq = (regs.hclkpll_control.feedback_divider + 1) * sys_freq; // in RUN mode, ARM clock taken from pll output
-            periph_freq = arm_freq / (regs.hclkdiv_control.periph_divider + 1);
-            ddr_freq = arm_freq / (regs.hclkdiv_control.ddram_divider); // careful about divider being invalid or 0
-            h_freq = arm_freq / (regs.hclkdiv_control.hclk_divider * 2);  // careful about divider being invalid or 0
-
-            // we will need system times in meaningful units, for example microseconds
-            // find the smallest periph_freq divisor which produces a multiple of 10
-            // so we don't have to multiply an already large number by 1,000,000 before dividing by periph_freq
-            periph_freq_div = periph_freq;
-            periph_freq_upscale = 1000000;
-            while (periph_freq_div == (periph_freq_div / 10) * 10)
-            {
-                periph_freq_div /= 10;
-                periph_freq_upscale /= 10;
-            }
+            read_frequencies();
 
             wrap_counter = 0;
 
@@ -54,7 +93,7 @@ namespace clock
 
             high_speed_timer::regs.control.enable = true; // start the timer
 
-            get_int_ctrl().install_service_routine(interrupt::id::high_speed_timer, int_priority, fast_irq, interrupt::trigger::high_level, static_high_speed_isr);
+            get_int_ctrl().install_service_routine(interrupt::id::high_speed_timer, int_priority, fast_irq, interrupt::trigger::high_level, interrupt::member_thunk<controller, &controller::high_speed_isr>, this);
             get_int_ctrl().enable_interrupt(interrupt::id::high_speed_timer);
         }
 
@@ -62,25 +101,96 @@ namespace clock
         u32 get_periph_freq() { return periph_freq; }
         u32 get_h_freq() { return h_freq; }
         u32 get_emc_freq() { return h_freq; }
+        u32 get_ddr_freq() { return ddr_freq; }
 
-        u64 get_system_time()
+        frequencies get_frequencies()
+        {
+            frequencies f;
+            f.arm = arm_freq;
+            f.h = h_freq;
+            f.ddr = ddr_freq;
+            f.periph = periph_freq;
+            return f;
+        }
+
+        bool add_client(clock_client& c)
+        {
+            for (u8 i = 0; i < client_count; ++i)
+                if (clients[i] == &c)
+                    return true;
+            if (client_count >= max_clients)
+                return false;
+            clients[client_count++] = &c;
+            return true;
+        }
+
+        // switch the ARM clock in RUN mode, to drop to a low clock when idle and boost for bursts. HCLK follows at half the ARM clock
+        // and the DDR at the ARM clock, as set by init. periph_clock is kept at the oscillator frequency, so the timers and the system time are not disturbed.
+        // the target must be a multiple of the oscillator frequency which the PLL can reach. returns false, without touching anything, otherwise.
+        bool set_arm_freq(u32 target)
         {
-            u64 result;
+            u32 pll, div;
+            frequencies next;
+            if (!solve_arm_freq(target, pll, div, next))
+                return false;
+            if (target == arm_freq)
+                return true;
+
+            frequencies current = get_frequencies();
+
+            // the EMC counts tXSR itself, but in cycles of the clock it restarts at : wait it out on the periph clock as well, it does not change
+            typedef emc::ddr_part ddr;
+            u32 exit_ns = (ddr::tXSR > ddr::tSREX) ? ddr::tXSR : ddr::tSREX;
+            u32 exit_ticks = (exit_ns * (periph_freq / 1000000) + 999) / 1000 + 1; // round up, plus one tick for the counter phase
 
-            u32 count_0, count_1;
-            u32 wrap_count;
+            int state = libarm_disable_irq_fiq();
+            for (u8 i = 0; i < client_count; ++i)
+                clients[i]->prepare_frequency_change(current, next);
 
-            // we must ensure that our snapshot of wrap_counter was not updated while the counter is near its wrap-up limit,
-            // or we may get a large over-evaluation error
-            do
+            switch_frequency(pll, div, exit_ticks);
+            read_frequencies();
+
+            for (u8 i = 0; i < client_count; ++i)
+                clients[i]->frequency_changed(next);
+            libarm_restore_irq_fiq(state);
+
+            return true;
+        }
+
+        // lock-free and bounded, safe from tasks, IRQ and FIQ handlers alike. the high speed ISR bumps the wrap count and clears its
+        // pending flag atomically, so a wrap is either pending or counted. if the wrap count moved while we were reading,
+        // the ISR ran in between and a second read of the counter is consistent with the new wrap count.
+        u64 get_system_time()
+        {
+            u32 wrap_count = wrap_counter;
+            u32 count = high_speed_timer::regs.counter;
+            bool pending = high_speed_timer::regs.interrupt_status.match_0_int;
+            u32 wrap_check = wrap_counter;
+
+            if (wrap_check != wrap_count)
             {
-                count_0 = high_speed_timer::regs.counter;
-                wrap_count = wrap_counter;
-                count_1 = high_speed_timer::regs.counter;
-            } while (count_1 < count_0);
+                wrap_count = wrap_check;
+                count = high_speed_timer::regs.counter;
+                pending = false; // just served, the next wrap is more than 5 minutes away
+            }
+
+            // the wrap happened but the ISR did not serve it yet (masked, or we are preempting it) : the counter restarted from 0 in the meantime
+            if (pending && count < 0x80000000)
+                ++wrap_count;
+
+            return (((u64)wrap_count) << 32) + count;
+        }
 
-            result = (((u64)wrap_count) << 32) + count_0;
-            return result;
+        // the low 32 bits of the system time, for measuring short intervals in hot paths without touching the wrap count.
+        // differences are valid for intervals up to 330 seconds at 13 MHz.
+        static u32 get_cycles()
+        {
+            return high_speed_timer::regs.counter;
+        }
+
+        static u32 cycles_since(u32 start)
+        {
+            return high_speed_timer::regs.counter - start; // modulo arithmetic handles the wrap
         }
 
         u64 get_system_freq()
@@ -90,12 +200,18 @@ namespace clock
 
         us system_to_microsec(u64& sys_time)
         {
-            return sys_time * periph_freq_upscale / periph_freq_div;
+            return to_microsec.apply(sys_time);
         }
 
         u32 system_to_millisec(u64& sys_time)
         {
-            return system_to_microsec(sys_time) / 1000;
+            return to_millisec.apply(sys_time);
+        }
+
+        // overflows after 584 years of uptime at 13 MHz
+        u64 system_to_nanosec(u64& sys_time)
+        {
+            return to_nanosec.apply(sys_time);
         }
 
         float system_to_sec(u64& sys_time)
@@ -118,7 +234,7 @@ namespace clock
         u32 get_sec_time()
         {
             u64 sys_time = get_system_time();
-            return sys_time / periph_freq;
+            return to_sec.apply(sys_time);
         }
 
         void get_human_time(u8& hour, u8& minute, u8& second, u32& microsec)
@@ -134,15 +250,62 @@ namespace clock
         }
 
     private:
-        static void static_high_speed_isr()
+        void read_frequencies()
+        {
+            // in RUN mode, ARM clock taken from pll output
+            u32 cco_freq = (regs.hclkpll_control.feedback_divider + 1) * sys_freq / (regs.hclkpll_control.pre_divider + 1);
+            arm_freq = regs.hclkpll_control.direct_output ? cco_freq : cco_freq / (2 << regs.hclkpll_control.post_divider);
+            periph_freq = arm_freq / (regs.hclkdiv_control.periph_divider + 1);
+            ddr_freq = arm_freq / (regs.hclkdiv_control.ddram_divider); // careful about divider being invalid or 0
+            h_freq = arm_freq >> regs.hclkdiv_control.hclk_divider; // by 1, 2 or 4
+
+            // we will need system times in meaningful units. a 64-bit division is a slow library call on the ARM926,
+            // so the conversion ratios are precomputed here, and converting only takes a few 32-bit multiplies
+            to_sec.set(1, periph_freq);
+            to_millisec.set(1000, periph_freq);
+            to_microsec.set(1000000, periph_freq);
+            to_nanosec.set(1000000000, periph_freq);
+        }
+
+        // finds the PLL setting producing the target ARM clock, with the current sysclk as its input
+        bool solve_arm_freq(u32 target, u32& hclkpll_value, u32& hclkdiv_value, frequencies& next)
         {
-            get_hw_clock().high_speed_isr();
+            if (!target || target > max_arm_freq || target % sys_freq)
+                return false;
+            u32 periph_divider = target / sys_freq; // keeps periph_clock at sysclk
+            if (periph_divider > 32)
+                return false;
+
+            // the CCO must run between 156 and 320 MHz : use it directly, or through the post divider (2, 4, 8 or 16)
+            for (u8 post = 0; post < 5; ++post)
+            {
+                u32 cco_freq = post ? target * (1 << post) : target;
+                if (cco_freq < min_cco_freq || cco_freq > max_cco_freq)
+                    continue;
+                u32 multiplier = cco_freq / sys_freq;
+                if (multiplier > 256)
+                    continue;
+
+                hclkpll_value = 0x00010000; // PLL powered, pre-divider by 1
+                hclkpll_value |= post ? ((post - 1) << 11) : 0x00004000; // post-divider, or direct output
+                hclkpll_value |= (multiplier - 1) << 1;
+                hclkdiv_value = (0x1 << 7) | ((periph_divider - 1) << 2) | 0x1; // ddram at ARM clock, hclk at half
+
+                next.arm = target;
+                next.h = target / 2;
+                next.ddr = target;
+                next.periph = target / periph_divider;
+                return true;
+            }
+            return false;
         }
 
         void high_speed_isr()
         {
+            int state = libarm_disable_irq_fiq(); // no reader, nested IRQ or FIQ, may see the new wrap count with the interrupt still pending
             ++wrap_counter;
             high_speed_timer::regs.interrupt_status.match_0_int = true; // clear the interrupt
+            libarm_restore_irq_fiq(state);
         }
 
         u32 sys_freq;
@@ -151,10 +314,20 @@ namespace clock
         u32 h_freq;
         u32 ddr_freq;
 
-        u32 periph_freq_div;
-        u32 periph_freq_upscale;
+        static const u32 max_arm_freq = 266000000;
+        static const u32 min_cco_freq = 156000000;
+        static const u32 max_cco_freq = 320000000;
+        static const u8 max_clients = 8;
+
+        clock_client* clients[max_clients];
+        u8 client_count;
+
+        fixed_ratio to_sec;
+        fixed_ratio to_millisec;
+        fixed_ratio to_microsec;
+        fixed_ratio to_nanosec;
 
-        u32 wrap_counter;
+        volatile u32 wrap_counter;
     };
 }
 
@@ -34,4 +34,108 @@ static void cp15_force_cache_coherence(u32* start_addr, u32* end_addr)
         asm("NOP");
         asm("NOP");
     }*/
+}
+
+// data cache maintenance around DMA, one direction at a time. the instruction cache is left alone : DMA buffers hold no code.
+// ranges are in bytes, end excluded, and need not be aligned on cache lines. past cp15_whole_cache_threshold bytes, going through
+// the whole cache once costs less than one operation per line of the range.
+static const u32 cp15_cache_line_bytes = 32;
+static const u32 cp15_data_cache_bytes = 32 * 1024;
+static const u32 cp15_whole_cache_threshold = cp15_data_cache_bytes;
+
+// waits until the write buffer has reached memory
+static inline void cp15_drain_write_buffer()
+{
+    __asm__ volatile("MCR p15, 0, %0, c7, c10, 4" : : "r"(0) : "memory");
+}
+
+static inline void cp15_clean_data_cache()
+{
+    __asm__ volatile("1:\n\t"
+                     "MRC p15, 0, r15, c7, c10, 3\n\t" // test and clean one dirty line, Z set once none is left
+                     "BNE 1b"
+                     : : : "cc", "memory");
+    cp15_drain_write_buffer();
+}
+
+static inline void cp15_clean_invalidate_data_cache()
+{
+    __asm__ volatile("1:\n\t"
+                     "MRC p15, 0, r15, c7, c14, 3\n\t" // test, clean and invalidate, the whole cache is invalidated once Z is set
+                     "BNE 1b"
+                     : : : "cc", "memory");
+    cp15_drain_write_buffer();
+}
+
+// before a device reads memory : writes the dirty lines of the range back, the cache keeps its copy
+static inline void cp15_clean_data_cache_range(const void* start, const void* end)
+{
+    u32 addr = reinterpret_cast<u32>(start) & ~(cp15_cache_line_bytes - 1);
+    u32 last = reinterpret_cast<u32>(end);
+    if (last > addr && last - addr > cp15_whole_cache_threshold)
+    {
+        cp15_clean_data_cache();
+        return;
+    }
+    for (; addr < last; addr += cp15_cache_line_bytes)
+        __asm__ volatile("MCR p15, 0, %0, c7, c10, 1" : : "r"(addr) : "memory"); // clean D-cache line by MVA
+    cp15_drain_write_buffer();
+}
+
+// before and after a device writes memory : drops the lines of the range, so the CPU reads what the device wrote and no dirty line
+// gets evicted over it. a line only partly in the range is cleaned first, the rest of it may be the only copy of other data.
+static inline void cp15_invalidate_data_cache_range(void* start, void* end)
+{
+    const u32 line_mask = cp15_cache_line_bytes - 1;
+    u32 first = reinterpret_cast<u32>(start);
+    u32 last = reinterpret_cast<u32>(end);
+    if (last <= first)
+        return;
+    if (last - first > cp15_whole_cache_threshold)
+    {
+        cp15_clean_invalidate_data_cache(); // invalidating alone would drop the dirty lines of everybody else
+        return;
+    }
+    if (first & line_mask)
+    {
+        __asm__ volatile("MCR p15, 0, %0, c7, c14, 1" : : "r"(first & ~line_mask) : "memory"); // clean and invalidate D-cache line by MVA
+        first = (first | line_mask) + 1;
+    }
+    if ((last & line_mask) && (last & ~line_mask) >= first)
+    {
+        __asm__ volatile("MCR p15, 0, %0, c7, c14, 1" : : "r"(last & ~line_mask) : "memory");
+        last &= ~line_mask;
+    }
+    for (; first < last; first += cp15_cache_line_bytes)
+        __asm__ volatile("MCR p15, 0, %0, c7, c6, 1" : : "r"(first) : "memory"); // invalidate D-cache line by MVA
+    cp15_drain_write_buffer(); // the partial lines may have been written back
+}
+
+// both directions, or a buffer the CPU is done with either way
+static inline void cp15_clean_invalidate_data_cache_range(const void* start, const void* end)
+{
+    u32 addr = reinterpret_cast<u32>(start) & ~(cp15_cache_line_bytes - 1);
+    u32 last = reinterpret_cast<u32>(end);
+    if (last > addr && last - addr > cp15_whole_cache_threshold)
+    {
+        cp15_clean_invalidate_data_cache();
+        return;
+    }
+    for (; addr < last; addr += cp15_cache_line_bytes)
+        __asm__ volatile("MCR p15, 0, %0, c7, c14, 1" : : "r"(addr) : "memory");
+    cp15_drain_write_buffer();
+}
+
+// stops the core clock until an interrupt is pending. the interrupt wakes the core even when masked in the CPSR,
+// so the caller can check its sleep condition with interrupts disabled and take the interrupt after re-enabling them.
+static inline void cp15_wait_for_interrupt()
+{
+    __asm__ volatile("MCR p15, 0, %0, c7, c0, 4" : : "r"(0) : "memory");
+}
+
+static inline bool cp15_data_cache_enabled()
+{
+    u32 control;
+    __asm__ volatile("MRC p15, 0, %0, c1, c0, 0" : "=r"(control));
+    return (control & 0x4) != 0; // C bit
 }
\ No newline at end of file
@@ -0,0 +1,39 @@
+#pragma once
+
+#include "armtastic/types.hpp"
+
+namespace lpc3230
+{
+
+namespace mem_types
+{
+
+struct ddr_mt46h16m16lf_6
+{
+    static const u32 size                   = 32 * 1024 * 1024; // 32 MB, 256 Mb
+    static const u32 memory_device          = 0x6;          // low-power DDR SDRAM
+    static const u32 address_mapping_code   = 0x2D;         // taken from LPC3230 spec sheet, for 256Mb, 16Mx16, low power ddr sdram over 16-bit bus
+    static const u32 standard_mode_register = 0x31;         // sequential burst length = 2, CAS = 3
+    static const u32 extended_mode_register = (0x1 << 13);  // full array refresh, full strength drives. one column bit less than the 512Mb part, the bank select moves down
+    static const u32 cas_latency            = 3;            // must match the standard mode register
+
+    // timing settings in ns
+    static const u32 tRP    = 18;   // Setup Percharge command delay
+    static const u32 tRAS   = 42;   // Setup Active to Precharge command period
+    static const u32 tSREX  = 113;  // Setup Self-refresh exit time. No tSREX or tXSNR in spec sheet, use tXSR instead.
+    static const u32 tWR    = 15;   // Setup Recovery time
+    static const u32 tRC    = 60;   // Setup Active To Active command period
+    static const u32 tRFC   = 72;   // Setup Auto-refresh period
+    static const u32 tXSR   = 113;  // Setup Exit self-refresh. 112.5 in the spec sheet
+    static const u32 tRRD   = 12;   // Setup Active bank A to Active bank B delay
+    static const u32 tRCD   = 18;   // Active to Read or Write delay
+    static const u32 tREFI  = 7800; // Average Periodic Refresh Interval
+
+    // timing settings in clock cycles
+    static const u32 tMRD   = 2;    // Setup Load mode register to Active command time
+    static const u32 tCDLR  = 2;    // Setup Memory last data in to Read command time. tCDLR not mentionned in spec. use a default value...
+};
+
+}
+
+}
\ No newline at end of file
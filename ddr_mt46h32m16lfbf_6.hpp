@@ -11,10 +11,11 @@ namespace mem_types
 struct ddr_mt46h32m16lfbf_6
 {
     static const u32 size                   = 64 * 1024 * 1024; // 64 MB, 512 Mb
-    static const u32 memory_device          = 0x4;          // DDR SDRAM
+    static const u32 memory_device          = 0x6;          // low-power DDR SDRAM
     static const u32 address_mapping_code   = 0x31;         // taken from LPC3230 spec sheet, for 512Mb, 32Mx16, low power ddr sdram over 16-bit bus
     static const u32 standard_mode_register = 0x31;         // sequential burst length = 2, CAS = 3
     static const u32 extended_mode_register = (0x1 << 14);  // full array refresh, full strength drives
+    static const u32 cas_latency            = 3;            // must match the standard mode register
 
     // timing settings in ns
     static const u32 tRP    = 18;   // Setup Percharge command delay
@@ -25,6 +26,7 @@ struct ddr_mt46h32m16lfbf_6
     static const u32 tRFC   = 97;   // Setup Auto-refresh period
     static const u32 tXSR   = 120;  // Setup Exit self-refresh
     static const u32 tRRD   = 12;   // Setup Active bank A to Active bank B delay
+    static const u32 tRCD   = 18;   // Active to Read or Write delay
     static const u32 tREFI  = 7800; // Average Periodic Refresh Interval
 
     // timing settings in clock cycles
@@ -0,0 +1,85 @@
+#pragma once
+
+#include "armtastic/types.hpp"
+#include "registers_lpc3230.hpp"
+
+// the part soldered on CS0. boards built with another one define its macro in the project settings
+#if DDR_PART_MT46H16M16LF_6
+    #include "ddr_mt46h16m16lf_6.hpp"
+#elif DDR_PART_MT46H64M16LF_6
+    #include "ddr_mt46h64m16lf_6.hpp"
+#else
+    #include "ddr_mt46h32m16lfbf_6.hpp"
+#endif
+
+namespace lpc3230
+{
+
+namespace emc
+{
+    #if DDR_PART_MT46H16M16LF_6
+        typedef mem_types::ddr_mt46h16m16lf_6 ddr_part;
+    #elif DDR_PART_MT46H64M16LF_6
+        typedef mem_types::ddr_mt46h64m16lf_6 ddr_part;
+    #else
+        typedef mem_types::ddr_mt46h32m16lfbf_6 ddr_part;
+    #endif
+
+    // the EMC timing registers count n + 1 EMC clock cycles : a delay of ns needs the cycles covering it, rounded up, minus one.
+    // the clock is taken in kHz, rounded up, so the product fits in 32 bits up to tREFI at the fastest HCLK.
+    template <u32 EmcClock, u32 Ns>
+    struct ns_to_register
+    {
+        static const u32 khz = (EmcClock + 999) / 1000;
+        BOOST_STATIC_ASSERT(khz > 0 && Ns <= 0xFFFFFFFF / khz);
+        static const u32 cycles = (Ns * khz + 999999) / 1000000;
+        static const u32 value = cycles ? cycles - 1 : 0;
+    };
+
+    // every register value of a part at a given EMC clock, checked against the width of its field.
+    // a part or a clock the EMC cannot time fails to compile instead of running with a truncated delay.
+    template <typename Part, u32 EmcClock>
+    struct ddr_timings
+    {
+        static const u32 emc_clock = EmcClock;
+
+        static const u32 tRP = ns_to_register<EmcClock, Part::tRP>::value;
+        static const u32 tRAS = ns_to_register<EmcClock, Part::tRAS>::value;
+        static const u32 tSREX = ns_to_register<EmcClock, Part::tSREX>::value;
+        static const u32 tWR = ns_to_register<EmcClock, Part::tWR>::value;
+        static const u32 tRC = ns_to_register<EmcClock, Part::tRC>::value;
+        static const u32 tRFC = ns_to_register<EmcClock, Part::tRFC>::value;
+        static const u32 tXSR = ns_to_register<EmcClock, Part::tXSR>::value;
+        static const u32 tRRD = ns_to_register<EmcClock, Part::tRRD>::value;
+        static const u32 tMRD = Part::tMRD - 1;
+        static const u32 tCDLR = Part::tCDLR - 1;
+
+        // in units of 16 EMC cycles, rounded down : refreshing a little early is harmless, late is not
+        static const u32 refresh = Part::tREFI * (EmcClock / 1000) / 1000000 / 16;
+
+        // the RAS latency field counts whole cycles, not n + 1. the CAS latency is in half cycles
+        static const u32 ras_cycles = ns_to_register<EmcClock, Part::tRCD>::cycles;
+        static const u32 ras_cas = ((Part::cas_latency * 2) << 7) | ras_cycles;
+
+        static const u32 dynamic_config = (Part::address_mapping_code << 7) | Part::memory_device;
+
+        BOOST_STATIC_ASSERT(tRP <= 0xF);
+        BOOST_STATIC_ASSERT(tRAS <= 0xF);
+        BOOST_STATIC_ASSERT(tSREX <= 0x7F);
+        BOOST_STATIC_ASSERT(tWR <= 0xF);
+        BOOST_STATIC_ASSERT(tRC <= 0x1F);
+        BOOST_STATIC_ASSERT(tRFC <= 0x1F);
+        BOOST_STATIC_ASSERT(tXSR <= 0xFF);
+        BOOST_STATIC_ASSERT(tRRD <= 0xF);
+        BOOST_STATIC_ASSERT(Part::tMRD >= 1 && tMRD <= 0xF);
+        BOOST_STATIC_ASSERT(Part::tCDLR >= 1 && tCDLR <= 0xF);
+        BOOST_STATIC_ASSERT(Part::tREFI <= 0xFFFFFFFF / (EmcClock / 1000));
+        BOOST_STATIC_ASSERT(refresh >= 1 && refresh <= 0x7FF);
+        BOOST_STATIC_ASSERT(ras_cycles >= 1 && ras_cycles <= 0xF);
+        BOOST_STATIC_ASSERT(Part::cas_latency * 2 <= 0xF);
+        BOOST_STATIC_ASSERT(((Part::standard_mode_register >> 4) & 0x7) == Part::cas_latency); // the EMC and the memory must agree on the CAS latency
+        BOOST_STATIC_ASSERT(Part::address_mapping_code <= 0xFF && Part::memory_device <= 0x7);
+    };
+}
+
+}
\ No newline at end of file
@@ -0,0 +1,123 @@
+#pragma once
+
+#include "armtastic/types.hpp"
+#include "registers_lpc3230.hpp"
+#include "mmu_arm926ejs.hpp"
+#include "cp15_arm926ejs.hpp"
+#include "assert.h"
+#include <ctl_api.h>
+
+namespace lpc3230
+{
+
+namespace dma
+{
+    // the megabytes of DDR seen a second time through an uncached, bufferable alias. a buffer reached through the alias never sits in
+    // the data cache : a driver skips the cache maintenance, and only drains the write buffer before a device reads what the CPU wrote.
+    // the CPU keeps its cached view of everything else, including the rest of these megabytes.
+    struct uncached_window
+    {
+        u32 alias_base;
+        u32 physical_base;
+        u32 bytes;
+
+        bool contains(const void* address) const
+        {
+            return reinterpret_cast<u32>(address) - alias_base < bytes;
+        }
+
+        // what the DMA controller must be given for an address the CPU uses. flat mapping outside the alias
+        u32 to_physical(const void* address) const
+        {
+            if (contains(address))
+                return reinterpret_cast<u32>(address) - alias_base + physical_base;
+            return reinterpret_cast<u32>(address);
+        }
+    };
+
+    // one window for the whole system, shared by every translation unit. empty until a buffer pool maps it
+    inline uncached_window& get_uncached_window()
+    {
+        static uncached_window window = { 0, 0, 0 };
+        return window;
+    }
+
+    // fixed-size buffers handed out through the uncached window. the pool lives in ordinary cached DDR : init maps the megabytes
+    // around it at alias_addr, then every access goes through the alias. the page table layout must leave the alias free for it,
+    // with a fault_run there, or map it already with an uncached_alias_run : the flat table of initialize_flat_page_tables does neither.
+    //   static dma::buffer_pool<512, 8> sd_buffers;
+    //   sd_buffers.init(page_table, 0x90000000);
+    //   u8* block = sd_buffers.allocate();
+    template <u32 BlockBytes, u32 BlockCount>
+    class buffer_pool
+    {
+        BOOST_STATIC_ASSERT(BlockBytes > 0 && BlockBytes % cp15_cache_line_bytes == 0); // no cache line shared with the neighbours
+        BOOST_STATIC_ASSERT(BlockCount > 0 && BlockCount <= 32);
+
+    public:
+        // alias_addr on a megabyte, free in the page table. false when the window is already taken or the alias cannot be mapped
+        bool init(u32* table, u32 alias_addr)
+        {
+            uncached_window& window = get_uncached_window();
+            if (window.bytes)
+                return false;
+
+            u32 physical = reinterpret_cast<u32>(storage);
+            u32 physical_base = physical & 0xfff00000;
+            u32 bytes = ((physical + sizeof(storage) - 1) | 0xfffff) + 1 - physical_base;
+
+            if (!map_uncached_alias(table, alias_addr, physical_base, bytes))
+                return false;
+            // the startup code may have left lines of the storage in the cache, dirty ones would be written over the DMA data
+            cp15_clean_invalidate_data_cache_range(storage, storage + sizeof(storage) / 4);
+
+            window.alias_base = alias_addr;
+            window.physical_base = physical_base;
+            window.bytes = bytes;
+
+            blocks = reinterpret_cast<u8*>(alias_addr + (physical - physical_base));
+            free_mask = 0xFFFFFFFF >> (32 - BlockCount);
+            return true;
+        }
+
+        // one block of BlockBytes, 0 when all are taken
+        u8* allocate()
+        {
+            int enabled = ctl_global_interrupts_disable(); // tasks and interrupt handlers may share the pool
+            u8* block = 0;
+            if (free_mask)
+            {
+                u32 b = __builtin_ctz(free_mask);
+                free_mask &= ~(1u << b);
+                block = blocks + b * BlockBytes;
+            }
+            ctl_global_interrupts_set(enabled);
+            return block;
+        }
+
+        // a block allocate returned, or 0. anything else, or a block released twice, is a bug in the caller
+        void release(u8* block)
+        {
+            if (!block)
+                return;
+            u32 offset = block - blocks;
+            assert(offset % BlockBytes == 0 && offset / BlockBytes < BlockCount);
+            if (offset % BlockBytes || offset / BlockBytes >= BlockCount)
+                return;
+            u32 b = offset / BlockBytes;
+            int enabled = ctl_global_interrupts_disable();
+            assert(!(free_mask & (1u << b))); // double free
+            free_mask |= 1u << b;
+            ctl_global_interrupts_set(enabled);
+        }
+
+        u32 free_blocks() const { return __builtin_popcount(free_mask); }
+
+    private:
+        u32 storage[BlockBytes * BlockCount / 4] __attribute__ ((aligned (32)));
+        u8* blocks; // storage, seen through the alias
+        volatile u32 free_mask;
+    };
+}
+
+}
\ No newline at end of file
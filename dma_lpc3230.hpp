@@ -3,6 +3,8 @@
 #include "armtastic/types.hpp"
 #include "registers_lpc3230.hpp"
 #include "interrupt_lpc3230.hpp"
+#include "modules/init/globals.hpp"
+#include "assert.h"
 
 namespace lpc3230
 {
@@ -28,19 +30,20 @@ namespace dma
 
             regs.int_error_clear = 0xFF;
 
-            for (u8 i = 0; i < 7; i++)
+            for (u8 i = 0; i < 8; i++)
                 routines[i] = 0;
 
-            get_int_ctrl().install_service_routine(interrupt::id::dma, priority, fast_irq, interrupt::trigger::high_level, static_isr);
+            get_int_ctrl().install_service_routine(interrupt::id::dma, priority, fast_irq, interrupt::trigger::high_level, interrupt::member_thunk<controller, &controller::isr>, this);
             get_int_ctrl().enable_interrupt(interrupt::id::dma);
         }
 
         template <u8 ChannelID>
-        void enable_sd_transmit(u32* source, u32* dest, interrupt::callback routine)
+        void enable_sd_transmit(u32* source, u32* dest, interrupt::context_callback routine, void* context = 0)
         {
             BOOST_STATIC_ASSERT(ChannelID < 8);
             
             routines[ChannelID] = routine;
+            contexts[ChannelID] = context;
 
             reg_channel<ChannelID>& channel = get_channel<ChannelID>();
             channel.channel_link_list_address.write(0);
@@ -65,11 +68,12 @@ namespace dma
         }
 
         template <u8 ChannelID>
-        void enable_sd_receive(u32* source, u32* dest, interrupt::callback routine)
+        void enable_sd_receive(u32* source, u32* dest, interrupt::context_callback routine, void* context = 0)
         {
             BOOST_STATIC_ASSERT(ChannelID < 8);
             
             routines[ChannelID] = routine;
+            contexts[ChannelID] = context;
 
             reg_channel<ChannelID>& channel = get_channel<ChannelID>();
             channel.channel_link_list_address.write(0);
@@ -93,6 +97,85 @@ namespace dma
             channel.enable = true;
         }
 
+        // memory to memory copy in 8-word bursts on both sides, polled to completion without the interrupt.
+        // usable before init, the scheduler or the interrupt controller. returns false on a bus error.
+        template <u8 ChannelID>
+        static bool copy_polled(const u32* source, u32* dest, u32 words)
+        {
+            while (words)
+            {
+                u32 chunk = (words > max_copy_words) ? max_copy_words : words;
+
+                start_copy<ChannelID>(source, dest, chunk);
+                while (copy_busy<ChannelID>());
+                if (copy_failed<ChannelID>())
+                    return false;
+
+                source += chunk;
+                dest += chunk;
+                words -= chunk;
+            }
+            return true;
+        }
+
+        // starts one memory to memory transfer of at most max_copy_words and returns, for callers doing something else meanwhile.
+        // poll copy_busy for its end, the channel interrupt is left masked.
+        template <u8 ChannelID>
+        static void start_copy(const u32* source, u32* dest, u32 words)
+        {
+            BOOST_STATIC_ASSERT(ChannelID < 8);
+            assert(words <= max_copy_words);
+            if (words > max_copy_words) // the count would wrap in its 12 bits : move the first chunk only, like copy_polled would
+                words = max_copy_words;
+
+            regs.clock_enable = true;
+            regs.config.enable = true;
+
+            reg_channel<ChannelID>& channel = get_channel<ChannelID>();
+
+            regs.int_tc_req_clear = 1 << ChannelID;
+            regs.int_error_clear = 1 << ChannelID;
+
+            channel.channel_link_list_address.write(0);
+            channel.channel_source_address = reinterpret_cast<u32>(source);
+            channel.channel_dest_address = reinterpret_cast<u32>(dest);
+            channel.channel_control.write(0);
+            channel.source_burst_size = 0x2; // 8 element burst
+            channel.dest_burst_size = 0x2; // 8 element burst
+            channel.source_transfer_width = 0x2; // 32-bit width
+            channel.dest_transfer_width = 0x2; // 32-bit width
+            channel.source_incremented = true;
+            channel.dest_incremented = true;
+            channel.transfer_size = words;
+
+            channel.channel_config.write(0);
+            channel.flow_control = 0; // memory to memory, the DMA controller is the flow controller
+            channel.enable = true;
+        }
+
+        // false once the transfer is over, or stopped on a bus error
+        template <u8 ChannelID>
+        static bool copy_busy()
+        {
+            reg_channel<ChannelID>& channel = get_channel<ChannelID>();
+            if (!channel.enable)
+                return false;
+            if (regs.raw_int_error_status & (1 << ChannelID))
+            {
+                channel.enable = false;
+                return false;
+            }
+            return true;
+        }
+
+        template <u8 ChannelID>
+        static bool copy_failed()
+        {
+            return (regs.raw_int_error_status & (1 << ChannelID)) != 0;
+        }
+
+        static const u32 max_copy_words = 0xFF8; // 12-bit transfer count, kept a multiple of the burst size
+
         template <u8 ChannelID>
         void disable()
         {
@@ -101,11 +184,6 @@ namespace dma
         }
     
     private:
-        static void static_isr()
-        {
-            get_dma().isr();
-        }
-
         void isr()
         {
             u8 active = regs.int_status;
@@ -115,7 +193,7 @@ namespace dma
                 if ((1 << ch) & active)
                 {
                     if (routines[ch])
-                        routines[ch]();
+                        routines[ch](contexts[ch]);
                     else
                         disable_channel(ch);
                 }
@@ -137,7 +215,8 @@ namespace dma
             }
         }
 
-        interrupt::callback routines[8];
+        interrupt::context_callback routines[8];
+        void* contexts[8];
     };
 
 }
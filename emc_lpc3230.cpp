@@ -6,7 +6,28 @@ namespace lpc3230
 
 namespace emc
 {
-    #define DynamicMemoryTypeCS0 mem_types::ddr_mt46h32m16lfbf_6
+    // the timings of the clock set up by clock::init, computed and checked by the compiler
+    typedef ddr_timings<ddr_part, clock::default_configuration::h_freq> boot_timings;
+
+    // same rounding as ns_to_register, for the clocks only known at run time
+    static u32 ns_to_cycles(u32 emc_clock, u32 ns) __attribute__ ((section (".reset")));
+    static u32 ns_to_cycles(u32 emc_clock, u32 ns)
+    {
+        return (ns * ((emc_clock + 999) / 1000) + 999999) / 1000000;
+    }
+
+    static u32 ns_to_register(u32 emc_clock, u32 ns) __attribute__ ((section (".reset")));
+    static u32 ns_to_register(u32 emc_clock, u32 ns)
+    {
+        u32 cycles = ns_to_cycles(emc_clock, ns);
+        return cycles ? cycles - 1 : 0;
+    }
+
+    static u32 refresh_register(u32 emc_clock) __attribute__ ((section (".reset")));
+    static u32 refresh_register(u32 emc_clock)
+    {
+        return ddr_part::tREFI * (emc_clock / 1000) / 1000000 / 16;
+    }
 
     void init_ddr_timings(u32 emc_clock)
     {
@@ -14,46 +35,48 @@ namespace emc
         /*
         // Setup Percharge command delay
         // This is the number of cycles minimum needed between a PRECHARGE command and a subsequent READ access
-        regs.dynamic_tRP = emc_clock / (1000000000 / DynamicMemoryTypeCS0::tRP) + 1;
+        regs.dynamic_tRP = ns_to_register(emc_clock, ddr_part::tRP);
     
         // Setup Active to Precharge command period
-        regs.dynamic_tRAS = emc_clock / (1000000000 / DynamicMemoryTypeCS0::tRAS) + 1;
+        regs.dynamic_tRAS = ns_to_register(emc_clock, ddr_part::tRAS);
     
         // Setup Self-refresh exit time
-        regs.dynamic_tSREX = emc_clock / (1000000000 / DynamicMemoryTypeCS0::tSREX) + 1;
+        regs.dynamic_tSREX = ns_to_register(emc_clock, ddr_part::tSREX);
     
         // Setup Recovery time
-        regs.dynamic_tWR = emc_clock / (1000000000 / DynamicMemoryTypeCS0::tWR) + 1;
+        regs.dynamic_tWR = ns_to_register(emc_clock, ddr_part::tWR);
     
         // Setup Active To Active command period
-        regs.dynamic_tRC = emc_clock / (1000000000 / DynamicMemoryTypeCS0::tRC) + 1;
+        regs.dynamic_tRC = ns_to_register(emc_clock, ddr_part::tRC);
     
         // Setup Auto-refresh period
-        regs.dynamic_tRFC = emc_clock / (1000000000 / DynamicMemoryTypeCS0::tRFC) + 1;
+        regs.dynamic_tRFC = ns_to_register(emc_clock, ddr_part::tRFC);
     
         // Setup Exit self-refresh
-        regs.dynamic_tXSR = emc_clock / (1000000000 / DynamicMemoryTypeCS0::tXSR) + 1;
+        regs.dynamic_tXSR = ns_to_register(emc_clock, ddr_part::tXSR);
     
         // Setup Active bank A to Active bank B delay
-        regs.dynamic_tRRD = emc_clock / (1000000000 / DynamicMemoryTypeCS0::tRRD) + 1;
+        regs.dynamic_tRRD = ns_to_register(emc_clock, ddr_part::tRRD);
     
         // Setup Load mode register to Active command time
-        regs.dynamic_tMRD = DynamicMemoryTypeCS0::tMRD;
+        regs.dynamic_tMRD = ddr_part::tMRD - 1;
     
         // Setup Memory last data in to Read command time
-        regs.dynamic_tCDLR = DynamicMemoryTypeCS0::tCDLR;
+        regs.dynamic_tCDLR = ddr_part::tCDLR - 1;
         */
 
-        EMCDynamictRP = emc_clock / (1000000000 / DynamicMemoryTypeCS0::tRP) + 1;
-        EMCDynamictRAS = emc_clock / (1000000000 / DynamicMemoryTypeCS0::tRAS) + 1;
-        EMCDynamictSREX = emc_clock / (1000000000 / DynamicMemoryTypeCS0::tSREX) + 1;
-        EMCDynamictWR = emc_clock / (1000000000 / DynamicMemoryTypeCS0::tWR) + 1;
-        EMCDynamictRC = emc_clock / (1000000000 / DynamicMemoryTypeCS0::tRC) + 1;
-        EMCDynamictRFC = emc_clock / (1000000000 / DynamicMemoryTypeCS0::tRFC) + 1;
-        EMCDynamictXSR = emc_clock / (1000000000 / DynamicMemoryTypeCS0::tXSR) + 1;
-        EMCDynamictRRD = emc_clock / (1000000000 / DynamicMemoryTypeCS0::tRRD) + 1;
-        EMCDynamictMRD = DynamicMemoryTypeCS0::tMRD;
-        EMCDynamictCDLR = DynamicMemoryTypeCS0::tCDLR;
+        // the registers count n + 1 cycles
+        EMCDynamictRP = ns_to_register(emc_clock, ddr_part::tRP);
+        EMCDynamictRAS = ns_to_register(emc_clock, ddr_part::tRAS);
+        EMCDynamictSREX = ns_to_register(emc_clock, ddr_part::tSREX);
+        EMCDynamictWR = ns_to_register(emc_clock, ddr_part::tWR);
+        EMCDynamictRC = ns_to_register(emc_clock, ddr_part::tRC);
+        EMCDynamictRFC = ns_to_register(emc_clock, ddr_part::tRFC);
+        EMCDynamictXSR = ns_to_register(emc_clock, ddr_part::tXSR);
+        EMCDynamictRRD = ns_to_register(emc_clock, ddr_part::tRRD);
+        EMCDynamictMRD = ddr_part::tMRD - 1;
+        EMCDynamictCDLR = ddr_part::tCDLR - 1;
+        EMCDynamicRasCas0 = ((ddr_part::cas_latency * 2) << 7) | ns_to_cycles(emc_clock, ddr_part::tRCD);
     }
 
     // follow the standard intialization sequence for mobile DDR. standard DDR is a little different, and not implemented.
@@ -74,15 +97,15 @@ namespace emc
         standard_timer::timer<0>::get().wait(1);
 
         // Optimal refresh interval (1 / tREFI)
-        regs.dynamic_refresh = clock::controller::get().get_emc_clock() / 16 / (1000000000 / DynamicMemoryTypeCS0::tREFI);
+        regs.dynamic_refresh = refresh_register(emc_clock);
 
         regs.dynamic_control.sdram_init_mode = 1; // MODE REGISTER LOAD
         // Load the standard mode register : DDR reads this value from its address bus
-        volatile u16 tmp = *(volatile u16*)(0x80000000 + DynamicMemoryTypeCS0::standard_mode_register);
+        volatile u16 tmp = *(volatile u16*)(0x80000000 + ddr_part::standard_mode_register);
 
         regs.dynamic_control.sdram_init_mode = 1; // MODE REGISTER LOAD
         // Reset the extended mode register : DDR reads this value from its address bus
-        tmp = *(volatile u16*)(0x80000000 + DynamicMemoryTypeCS0::extended_mode_register);
+        tmp = *(volatile u16*)(0x80000000 + ddr_part::extended_mode_register);
 
         regs.dynamic_control.sdram_init_mode = 0; // NORMAL
         regs.dynamic_control.force_clock_enable_high = 0; // return to normal clock and clock enable mode
@@ -95,11 +118,11 @@ namespace emc
         EMCDynamicControl = 0x00000103; // SDRAM PALL|CS|CE /* 0x00000113); // SDRAM PALL|IMMC|CS|CE*/
         EMCDynamicRefresh = 0x00000002; // CS
         standard_timer::timer_0_wait(periph_clock, 1);
-        EMCDynamicRefresh = emc_clock / 16 / (1000000000 / DynamicMemoryTypeCS0::tREFI);
+        EMCDynamicRefresh = refresh_register(emc_clock);
         EMCDynamicControl = 0x00000083; // SDRAM NORMAL|CS|CE /*0x00000093); // SDRAM NORMAL|IMMC|CS|CE*/
-        tmp = *(u16*)(0x80000031);
+        tmp = *(u16*)(0x80000000 + ddr_part::standard_mode_register);
         EMCDynamicControl = 0x00000083; // SDRAM NORMAL|CS|CE /*0x00000093); // SDRAM NORMAL|IMMC|CS|CE*/
-        tmp = *(u16*)(0x80004000);
+        tmp = *(u16*)(0x80000000 + ddr_part::extended_mode_register);
         EMCDynamicControl = 0x00000000; // SDRAM NORMAL
     }
 
@@ -132,11 +155,11 @@ namespace emc
         regs.control.enable = 1; // enable EMC
         regs.config.big_endian = 0; // little endian
         
-        regs.dynamic_config_0.memory_device = DynamicMemoryTypeCS0::memory_device;
-        regs.dynamic_config_0.address_mapping = DynamicMemoryTypeCS0::address_mapping_code;
+        regs.dynamic_config_0.memory_device = ddr_part::memory_device;
+        regs.dynamic_config_0.address_mapping = ddr_part::address_mapping_code;
         
-        regs.dynamic_ras_cas_0.ras_cycles = 2;
-        regs.dynamic_ras_cas_0.cas_half_cycles = 6; // CAS = 3
+        regs.dynamic_ras_cas_0.ras_cycles = ns_to_cycles(emc_clock, ddr_part::tRCD);
+        regs.dynamic_ras_cas_0.cas_half_cycles = ddr_part::cas_latency * 2;
 
         regs.dynamic_read_config.sdram_read_strategy = 1; // command delayed by CMD_DELAY
         regs.dynamic_read_config.sdram_capture_polarity_positive = 1; // SDR data captured on pos edge
@@ -154,7 +177,7 @@ namespace emc
         EMCAHBControl0 = 0x00000001;
         EMCAHBControl3 = 0x00000001;
         EMCAHBControl4 = 0x00000001;
-        EMCAHBTimeOut0 = 0x00000064;
+        EMCAHBTimeOut0 = 0x00000064; // ahb_profile::balanced. the table lives in DDR, not yet up
         EMCAHBTimeOut3 = 0x00000190;
         EMCAHBTimeOut4 = 0x00000190;
 
@@ -167,27 +190,198 @@ namespace emc
         DDR_LAP_NOM = 0x21; // nominal value for periph_clock = 13MHz is 0x20 (32). we can extrapolate that at 12.5MHz, using
                             // a proportional, we should have 33.28 laps per period, or 0x21 rounded.
                             // at room temp, we measure 38 in the DDR_LAP_COUNT after a calibration.
+        #if RETAIN_DDR_CALIBRATION
+            retained_calibration calibration;
+            if (get_retained_calibration(calibration))
+                DDR_LAP_NOM = calibration.lap_nominal; // warm reset : the one measured with the delay we will reuse
+        #endif
         
         EMCControl = 0x00000001; // EMC enabled
         EMCConfig = 0x00000000; // Little endian mode
         
-        EMCDynamicConfig0 = 0x00001886; // 16-bit low-power DDR SDRAM 512Mb, 32Mx16 | low power DDR SDRAM
-        EMCDynamicRasCas0 = 0x00000302;
+        EMCDynamicConfig0 = boot_timings::dynamic_config; // memory device and address mapping of the part
         EMCDynamicReadConfig = 0x00000111;
 
-        init_ddr_timings(emc_clock);
+        if (emc_clock == boot_timings::emc_clock) // the usual case : nothing left to compute
+        {
+            EMCDynamictRP = boot_timings::tRP;
+            EMCDynamictRAS = boot_timings::tRAS;
+            EMCDynamictSREX = boot_timings::tSREX;
+            EMCDynamictWR = boot_timings::tWR;
+            EMCDynamictRC = boot_timings::tRC;
+            EMCDynamictRFC = boot_timings::tRFC;
+            EMCDynamictXSR = boot_timings::tXSR;
+            EMCDynamictRRD = boot_timings::tRRD;
+            EMCDynamictMRD = boot_timings::tMRD;
+            EMCDynamictCDLR = boot_timings::tCDLR;
+            EMCDynamicRasCas0 = boot_timings::ras_cas;
+        }
+        else // started by a loader at another clock
+            init_ddr_timings(emc_clock);
 
         init_ddr_sequence(emc_clock, periph_clock);
 
         EMCStaticConfig0 = 0x81;
     }
 
+    void set_ddr_refresh(u32 emc_clock)
+    {
+        EMCDynamicRefresh = refresh_register(emc_clock);
+    }
+
+    #if RETAIN_DDR_CALIBRATION
+        static retained_calibration retained __attribute__ ((section (".non_init")));
+        static const u32 retained_magic = 0x44515343; // "DQSC"
+
+        static u32 retained_check(const retained_calibration& c) __attribute__ ((section (".reset")));
+        static u32 retained_check(const retained_calibration& c)
+        {
+            return ~(c.magic + (c.dqs_in_delay << 3) + (c.sensitivity << 11) + (c.lap_nominal << 17) + c.hclkpll_control + (c.hclkdiv_control << 5) + ddr_part::size);
+        }
+
+        bool get_retained_calibration(retained_calibration& calibration)
+        {
+            if (retained.magic != retained_magic || retained.check != retained_check(retained))
+                return false;
+            if (retained.hclkpll_control != HCLKPLL_CTRL || retained.hclkdiv_control != HCLKDIV_CTRL)
+                return false;
+            // field by field : a structure copy may become a call to memcpy, which lives in DDR
+            calibration.magic = retained.magic;
+            calibration.dqs_in_delay = retained.dqs_in_delay;
+            calibration.sensitivity = retained.sensitivity;
+            calibration.lap_nominal = retained.lap_nominal;
+            calibration.hclkpll_control = retained.hclkpll_control;
+            calibration.hclkdiv_control = retained.hclkdiv_control;
+            calibration.check = retained.check;
+            return true;
+        }
+
+        void retain_calibration(u32 dqs_in_delay, u32 sensitivity, u32 lap_nominal)
+        {
+            retained.magic = retained_magic;
+            retained.dqs_in_delay = dqs_in_delay;
+            retained.sensitivity = sensitivity;
+            retained.lap_nominal = lap_nominal;
+            retained.hclkpll_control = HCLKPLL_CTRL;
+            retained.hclkdiv_control = HCLKDIV_CTRL;
+            retained.check = retained_check(retained);
+        }
+
+        void forget_retained_calibration()
+        {
+            retained.magic = 0;
+        }
+    #endif
+
+    struct ahb_timeouts
+    {
+        const char* name;
+        u32 dma;
+        u32 instruction;
+        u32 data;
+    };
+
+    static const ahb_timeouts ahb_profiles[ahb_profile::count] =
+    {
+        { "balanced",     0x064, 0x190, 0x190 }, // must match init
+        { "dma_favoured", 0x010, 0x3FF, 0x3FF },
+        { "cpu_favoured", 0x3FF, 0x020, 0x020 },
+    };
+
+    static ahb_profile::en current_ahb_profile = ahb_profile::balanced;
+
+    void set_ahb_profile(ahb_profile::en profile)
+    {
+        if (profile >= ahb_profile::count)
+            return;
+        EMCAHBTimeOut0 = ahb_profiles[profile].dma;
+        EMCAHBTimeOut3 = ahb_profiles[profile].instruction;
+        EMCAHBTimeOut4 = ahb_profiles[profile].data;
+        current_ahb_profile = profile;
+    }
+
+    ahb_profile::en get_ahb_profile()
+    {
+        return current_ahb_profile;
+    }
+
+    const char* get_ahb_profile_name(ahb_profile::en profile)
+    {
+        return (profile < ahb_profile::count) ? ahb_profiles[profile].name : "";
+    }
+
+    void clock_follower::init(clock::controller& c)
+    {
+        c.add_client(*this);
+    }
+
+    void clock_follower::prepare_frequency_change(const clock::frequencies& current, const clock::frequencies& next)
+    {
+        // until the switch is over, the settings must hold at both clocks : count the delays at the faster one, and refresh at the pace of the slower one
+        u32 faster = (current.h > next.h) ? current.h : next.h;
+        u32 slower = (current.h > next.h) ? next.h : current.h;
+        init_ddr_timings(faster);
+        set_ddr_refresh(slower);
+    }
+
+    void clock_follower::frequency_changed(const clock::frequencies& current)
+    {
+        init_ddr_timings(current.h);
+        set_ddr_refresh(current.h);
+        start_calibration_cycle(); // the DQS delay measured by the calibration depends on the DDR clock
+    }
+
     void start_calibration_cycle()
     {
         SDRAMCLK_CTRL |=  0x00000100; // calibrate
         SDRAMCLK_CTRL &= ~0x00000100;
     }
 
+    static bool recalibration_started = false;
+
+    bool recalibration_scheduled()
+    {
+        return recalibration_started;
+    }
+
+    void recalibration::init(software_timer::wheel& w, u32 min_interval_ms, u32 max_interval_ms)
+    {
+        wheel = &w;
+        min_interval = wheel->ms_to_ticks(min_interval_ms);
+        max_interval = wheel->ms_to_ticks(max_interval_ms);
+        interval = wheel->ms_to_ticks(initial_interval_ms);
+        if (interval < min_interval) interval = min_interval;
+        if (interval > max_interval) interval = max_interval;
+        last_lap_count = DDR_LAP_COUNT;
+        calibrations = 0;
+
+        wheel->start(job, interval, 0, expired, this);
+        recalibration_started = true;
+    }
+
+    void recalibration::expired(void* context)
+    {
+        static_cast<recalibration*>(context)->run();
+    }
+
+    void recalibration::run()
+    {
+        // the lap count of the previous calibration has long been latched : many periph_clock cycles went by since it started
+        u32 lap_count = DDR_LAP_COUNT;
+        u32 drift = (lap_count > last_lap_count) ? lap_count - last_lap_count : last_lap_count - lap_count;
+        last_lap_count = lap_count;
+
+        if (drift >= moving_drift)
+            interval = (interval / 2 > min_interval) ? interval / 2 : min_interval;
+        else if (drift <= stable_drift)
+            interval = (interval * 2 < max_interval) ? interval * 2 : max_interval;
+
+        start_calibration_cycle();
+        ++calibrations;
+
+        wheel->start(job, interval, 0, expired, this);
+    }
+
 }
 
 }
\ No newline at end of file
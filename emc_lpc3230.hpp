@@ -3,8 +3,16 @@
 #include "armtastic/types.hpp"
 #include "registers_lpc3230.hpp"
 #include "clock_lpc3230.hpp"
+#include "clock_client.hpp"
 #include "timer_lpc3230.hpp"
-#include "ddr_mt46h32m16lfbf_6.hpp"
+#include "timer_wheel_lpc3230.hpp"
+#include "ddr_timing_lpc3230.hpp"
+#include <boost/static_assert.hpp>
+#include <boost/type_traits/is_same.hpp>
+#if ENABLE_DDR_BURST_TEST
+    #include "dma_lpc3230.hpp"
+    #include "cp15_arm926ejs.hpp"
+#endif
 
 namespace lpc3230
 {
@@ -26,14 +34,101 @@ namespace emc
     void init_ddr_sequence(u32 emc_clock, u32 periph_clock) __attribute__ ((section (".reset")));
 
     // initialization for emc is not executed from within the controller as in some scenarios this needs to be run before static objects have been constructed
+    // the DQS delay drifts with the temperature : once the scheduler and a software_timer::wheel run, start an emc::recalibration on it.
+    // until then, the CTL tick (standard_timer::ctl_timer_isr) starts a calibration once a second.
     void init(u32 emc_clock, u32 periph_clock) __attribute__ ((section (".reset")));
 
+    void set_ddr_refresh(u32 emc_clock);
+
+    // how the EMC shares the DDR between its AHB ports : port 0 carries the DMA, ports 3 and 4 the CPU instruction and data fetches.
+    // each port gains priority once its request waited for its timeout, in AHB cycles : the shorter the timeout, the sooner it wins.
+    namespace ahb_profile
+    {
+        enum en
+        {
+            balanced,       // the boot settings : DMA first after 100 cycles, the CPU after 400
+            dma_favoured,   // streaming peripherals (SD, uarts) never wait long, the CPU waits longer
+            cpu_favoured,   // compute : the CPU wins quickly, the DMA only when it starves
+            count,
+        };
+    }
+
+    // may be switched at any time, the new timeouts apply to the next arbitration
+    void set_ahb_profile(ahb_profile::en profile);
+    ahb_profile::en get_ahb_profile();
+    const char* get_ahb_profile_name(ahb_profile::en profile);
+
     void start_calibration_cycle();
     void apply_calibration();
+    bool recalibration_scheduled(); // true once a recalibration job took over from the CTL tick
+
+    #if RETAIN_DDR_CALIBRATION
+        // the DQS search results, kept in a section of internal RAM the startup code does not clear : a warm reset (watchdog, software)
+        // finds them again and only verifies them. after a power cycle the check word does not match, and the full search runs.
+        struct retained_calibration
+        {
+            u32 magic;
+            u32 dqs_in_delay;
+            u32 sensitivity;
+            u32 lap_nominal; // DDR_LAP_COUNT measured right after the search, the reference the calibrated delay is scaled against
+            u32 hclkpll_control; // the clock the delay was found at
+            u32 hclkdiv_control;
+            u32 check;
+        };
+
+        // false when there is no record, or it was made at another clock or for another part
+        bool get_retained_calibration(retained_calibration& calibration) __attribute__ ((section (".reset")));
+        void retain_calibration(u32 dqs_in_delay, u32 sensitivity, u32 lap_nominal);
+        void forget_retained_calibration();
+    #endif
+
+    // keeps the DDR timings and refresh period in step with the EMC clock across frequency changes
+    class clock_follower : public clock_client
+    {
+    public:
+        void init(clock::controller& c);
+
+        virtual void prepare_frequency_change(const clock::frequencies& current, const clock::frequencies& next);
+        virtual void frequency_changed(const clock::frequencies& current);
+    };
+
+    // runs the DDR delay calibration as a software timer job instead of on a fixed count of CTL ticks.
+    // the lap count measured by each calibration follows the temperature of the chip : while it moves, the interval is halved,
+    // once it stays put, the interval doubles, so the EMC is rarely stalled in steady state and still tracks thermal swings.
+    class recalibration
+    {
+    public:
+        recalibration() : wheel(0), interval(0), min_interval(0), max_interval(0), last_lap_count(0), calibrations(0) {}
+
+        void init(software_timer::wheel& w, u32 min_interval_ms = 100, u32 max_interval_ms = 30000);
+
+        u32 get_interval_ms() { return interval * wheel->get_tick_usec() / 1000; }
+        u32 get_last_lap_count() { return last_lap_count; }
+        u32 get_calibration_count() { return calibrations; }
+
+    private:
+        static void expired(void* context);
+        void run();
+
+        static const u32 initial_interval_ms = 1000; // what the CTL tick used to give us
+        static const u32 stable_drift = 0; // lap count change under which the temperature is considered steady
+        static const u32 moving_drift = 2; // lap count change from which the temperature is considered moving
+
+        software_timer::wheel* wheel;
+        software_timer::timer job;
+        u32 interval; // in wheel ticks
+        u32 min_interval;
+        u32 max_interval;
+        u32 last_lap_count;
+        u32 calibrations;
+    };
 
     template <typename DynamicMemoryTypeCS0_t>
     class controller
     {
+        // the registers are programmed from ddr_part (emc_lpc3230.cpp) : the size test must check that same part
+        BOOST_STATIC_ASSERT((boost::is_same<DynamicMemoryTypeCS0_t, ddr_part>::value));
+
     public:
         void init() // not used. only shown as an example. real init code is called from assembly, and lives in the cpp file.
         {
@@ -43,8 +138,27 @@ namespace emc
         void init_ddr()
         {
             #if FIND_OPTIMAL_DQSIN_DELAY
+                #if ENABLE_DDR_BURST_TEST
+                    for (u8 i = 0; i < 32; i++)
+                        burst_ticks[i] = 0;
+                #endif
                 regs.sdramclk_control.use_calibrated_delay = 0;
-                bool ok = find_dqsin_delay();
+                bool ok = false;
+                #if RETAIN_DDR_CALIBRATION
+                    ok = reuse_retained_calibration();
+                #endif
+                if (!ok)
+                {
+                    #if FAST_DQSIN_SEARCH
+                        ok = find_dqsin_delay_fast();
+                    #else
+                        ok = find_dqsin_delay();
+                    #endif
+                    #if RETAIN_DDR_CALIBRATION
+                        if (ok)
+                            retain_current_calibration();
+                    #endif
+                }
                 ok = test_memory_size(DynamicMemoryTypeCS0_t::size);
                 regs.sdramclk_control.use_calibrated_delay = 1;
             #else
@@ -52,6 +166,16 @@ namespace emc
             #endif
         }
 
+        #if ENABLE_DDR_BURST_TEST
+            // bandwidth measured by the burst test of a delay, in KB/s. 0 if that delay was not tested, or failed.
+            u32 get_burst_bandwidth(u8 delay, u32 periph_clock)
+            {
+                if (delay >= 32 || !burst_ticks[delay])
+                    return 0;
+                return static_cast<u32>(static_cast<u64>(2 * burst_test_bytes) * periph_clock / 1024 / burst_ticks[delay]);
+            }
+        #endif
+
     private:
         bool test_memory_size(u32 size)
         {
@@ -97,7 +221,7 @@ namespace emc
                 set_delay(dqsin_delay);
                 
                 // bunch of different memory tests taken from reference lpc3230 DDR code (archive named code.lpc32x0.ddr.setup.zip on NXP web site)
-                if (run_memory_tests(dqsin_delay))
+                if (run_memory_tests(dqsin_delay) && run_burst_tests(dqsin_delay))
                 {
                     working_delays[dqsin_delay] = true;
         
@@ -112,8 +236,8 @@ namespace emc
                 {
                     working_delays[dqsin_delay] = false;
         
-                    // test failed. if a previous test worked, then we have a range!
-                    if (one_delay_passed == 1)
+                    // test failed. if a previous test worked, then we have a range! only the first failure past it ends the range
+                    if (one_delay_passed == 1 && end_delay == 0xFF)
                     {
                         end_delay = dqsin_delay - 1;
                         then_one_delay_failed = 1;
@@ -139,6 +263,113 @@ namespace emc
             return one_delay_passed;
         }
 
+        // same choice as find_dqsin_delay in a fraction of the time, as long as the working delays form a single window : its edges are found by bisection
+        // using a coarse test (few sections, two patterns), and only the chosen delay gets the full test. falls back to the full sweep if it fails it.
+        bool find_dqsin_delay_fast()
+        {
+            // probe around the value most often found first, moving out towards both ends
+            static const u8 probe_order[] = {16, 12, 20, 8, 24, 4, 28, 14, 18, 10, 22, 6, 26, 2, 30};
+            u8 passing = 0xFF;
+            for (u8 i = 0; i < sizeof(probe_order) && passing == 0xFF; ++i)
+            {
+                if (run_coarse_test(probe_order[i]))
+                    passing = probe_order[i];
+            }
+            if (passing == 0xFF)
+                return find_dqsin_delay();
+
+            // lower edge : first passing delay, between the lowest delay and a known pass
+            u8 begin_delay = passing;
+            if (run_coarse_test(min_delay))
+                begin_delay = min_delay;
+            else
+            {
+                u8 failing = min_delay;
+                while (begin_delay - failing > 1)
+                {
+                    u8 middle = (begin_delay + failing) / 2;
+                    if (run_coarse_test(middle))
+                        begin_delay = middle;
+                    else
+                        failing = middle;
+                }
+            }
+
+            // upper edge : last passing delay, between a known pass and the highest delay
+            u8 end_delay = passing;
+            if (run_coarse_test(max_delay))
+                end_delay = max_delay;
+            else
+            {
+                u8 failing = max_delay;
+                while (failing - end_delay > 1)
+                {
+                    u8 middle = (end_delay + failing) / 2;
+                    if (run_coarse_test(middle))
+                        end_delay = middle;
+                    else
+                        failing = middle;
+                }
+            }
+
+            // the full sweep takes the centre only once a delay failed past the window : a window reaching max_delay gets its safe default
+            u8 dqsin_delay = (end_delay < max_delay) ? (begin_delay + end_delay) / 2 : 0xF;
+            set_delay(dqsin_delay);
+            if (!run_memory_tests(dqsin_delay) || !run_burst_tests(dqsin_delay)) // the window was not a single one, or the coarse test missed a failure
+                return find_dqsin_delay();
+
+            working_delays[dqsin_delay] = true;
+            return true;
+        }
+
+        bool run_coarse_test(u8 delay)
+        {
+            set_delay(delay);
+            return run_memory_tests(delay, coarse_sections, coarse_test_vector);
+        }
+
+        #if RETAIN_DDR_CALIBRATION
+            // the delay of the last search, if it still passes a coarse test along with the delays verify_margin steps away on each side :
+            // the window may have moved with the temperature since. any failure sends us to the full search.
+            bool reuse_retained_calibration()
+            {
+                retained_calibration calibration;
+                if (!get_retained_calibration(calibration) || calibration.dqs_in_delay < min_delay || calibration.dqs_in_delay > max_delay)
+                    return false;
+
+                u8 delay = calibration.dqs_in_delay;
+                u8 lowest = (delay - min_delay > verify_margin) ? delay - verify_margin : min_delay;
+                u8 highest = (max_delay - delay > verify_margin) ? delay + verify_margin : max_delay;
+                if (!run_coarse_test(lowest) || !run_coarse_test(highest) || !run_coarse_test(delay))
+                {
+                    forget_retained_calibration();
+                    return false;
+                }
+
+                regs.sdramclk_control.dqs_in_delay = delay;
+                regs.sdramclk_control.sensitivity_factor = calibration.sensitivity;
+                if (!run_burst_tests(delay))
+                {
+                    forget_retained_calibration();
+                    return false;
+                }
+
+                working_delays[delay] = true;
+                return true;
+            }
+
+            // the delay was found with the calibration out of the loop : measuring the lap count now and making it the nominal one
+            // has the calibrated delay start out as the delay found, then follow the temperature from there
+            void retain_current_calibration()
+            {
+                start_calibration_cycle();
+                standard_timer::timer_0_wait(clock::default_configuration::periph_freq, 1);
+                u32 lap_count = regs.ddr_lap_count;
+                regs.ddr_lap_nom = lap_count;
+                retain_calibration(regs.sdramclk_control.dqs_in_delay, regs.sdramclk_control.sensitivity_factor, lap_count);
+            }
+        #endif
+
         // write a pattern with a walking bit unset : 111110, 111101, 111011, etc. on different addresses
         static void walking_0_bit_setup(volatile u32* base)
         {
@@ -296,8 +527,9 @@ namespace emc
         }
         
         static const memory_test test_vector[];
+        static const memory_test coarse_test_vector[];
         
-        bool run_memory_tests(u32 seed)
+        bool run_memory_tests(u32 seed, u32 sections = 256, const memory_test* tests = test_vector)
         {
             u8 testnum;
             u32 start = 0x80000000;
@@ -309,7 +541,7 @@ namespace emc
             // from a previous test
             base += (seed * 0x4000) + (seed * 4);
             inc = size / sizeof(unsigned int);
-            inc = inc / 256; // 256 test sections over test range
+            inc = inc / sections; // test sections spread over test range
         
             // The DDR test is performed on a number of sections. Sections are
             // small areas of DDR memory separated by untested areas. The
@@ -320,10 +552,10 @@ namespace emc
             {
                 // Loop through each test
                 testnum = 0;
-                while (test_vector[testnum].setup != NULL)
+                while (tests[testnum].setup != NULL)
                 {
-                    test_vector[testnum].setup(base);
-                    if (test_vector[testnum].check(base) == 0)
+                    tests[testnum].setup(base);
+                    if (tests[testnum].check(base) == 0)
                     {
                         // Test failed
                         return false;
@@ -339,8 +571,147 @@ namespace emc
             return true;
         }
 
+        #if ENABLE_DDR_BURST_TEST
+            // the word tests access memory one word at a time, which never produces the burst traffic where the DQS timing margins fail first.
+            // here, each LDM/STM of 8 registers is one 8-beat burst, then a DMA copy adds bursts from the other AHB master. when the data cache is on,
+            // the area is cleaned and invalidated between writing and reading, so the reads are cache line fills, also 8-beat bursts.
+            // the bursts run twice : through the DDR mapping in use, cached when the startup code turned the cache on, then through the
+            // .ddr_bss_no_cache section, where the CPU reads and writes reach the DDR without line fills nor evictions.
+            // also measures the CPU streaming bandwidth at that delay, through the first view.
+            bool run_burst_tests(u32 seed)
+            {
+                burst_ticks[seed & 0x1F] = 0;
+
+                u32* area = reinterpret_cast<u32*>(0x80000000 + burst_test_offset + (seed & 0xF) * 2 * burst_test_bytes);
+                if (!run_burst_pass(area, burst_test_bytes, seed, true))
+                    return false;
+
+                // half the size of the first area : that one is only borrowed from the application, this one stays reserved
+                static u32 uncached_area[burst_test_bytes / 4] __attribute__ ((section (".ddr_bss_no_cache"), aligned (32)));
+                return run_burst_pass(uncached_area, burst_test_bytes / 2, seed, false);
+            }
+
+            // bytes written with STM, read back with LDM, then DMA copied to the bytes following them and read back again.
+            // cache maintenance and bandwidth measure only for the cached view
+            bool run_burst_pass(u32* area, u32 bytes, u32 seed, bool cached_view)
+            {
+                u32* copy = area + bytes / 4;
+                u32* area_end = copy;
+                u32 block[8];
+                bool cached = cached_view && cp15_data_cache_enabled();
+
+                // every word differs from its neighbours and from the other blocks, and half of the bits toggle from one beat to the next
+                for (u32* b = area; b < area_end; b += 8)
+                {
+                    for (u8 i = 0; i < 8; ++i)
+                        block[i] = burst_pattern(b + i, seed);
+                    burst_store(b, block);
+                }
+                if (cached)
+                    cp15_force_cache_coherence(area, area_end);
+
+                if (!burst_check(area, area_end, 0, seed))
+                    return false;
+
+                if (!dma::controller::copy_polled<burst_test_dma_channel>(area, copy, bytes / 4))
+                    return false;
+                if (cached)
+                    cp15_force_cache_coherence(copy, copy + bytes / 4); // drop whatever the cache still holds for the copy
+                if (!burst_check(copy, copy + bytes / 4, bytes, seed)) // copied words carry the pattern of their source address
+                    return false;
+
+                if (!cached_view)
+                    return true;
+
+                // bandwidth : stream writes then reads, with nothing but the burst instructions in the loops
+                standard_timer::timer_0_start_count();
+                u32 start = standard_timer::timer_0_get_count();
+                burst_fill(area, area_end);
+                if (cached)
+                    cp15_force_cache_coherence(area, area_end);
+                burst_drain(area, area_end);
+                u32 ticks = standard_timer::timer_0_get_count() - start;
+                standard_timer::timer_0_stop_count();
+
+                burst_ticks[seed & 0x1F] = ticks ? ticks : 1;
+                return true;
+            }
+
+            static u32 burst_pattern(const u32* address, u32 seed)
+            {
+                u32 value = reinterpret_cast<u32>(address) ^ (seed * 0x9E3779B9);
+                return (reinterpret_cast<u32>(address) & 0x4) ? ~value : value;
+            }
+
+            static bool burst_check(const u32* start, const u32* end, u32 source_distance, u32 seed)
+            {
+                u32 block[8];
+                for (const u32* b = start; b < end; b += 8)
+                {
+                    burst_load(b, block);
+                    for (u8 i = 0; i < 8; ++i)
+                        if (block[i] != burst_pattern(reinterpret_cast<const u32*>(reinterpret_cast<u32>(b + i) - source_distance), seed))
+                            return false;
+                }
+                return true;
+            }
+
+            static void burst_store(u32* dest, const u32* block)
+            {
+                __asm__ volatile("LDMIA %1, {r3-r10}\n\t"
+                                 "STMIA %0, {r3-r10}"
+                                 : : "r"(dest), "r"(block) : "r3", "r4", "r5", "r6", "r7", "r8", "r9", "r10", "memory");
+            }
+
+            static void burst_load(const u32* source, u32* block)
+            {
+                __asm__ volatile("LDMIA %0, {r3-r10}\n\t"
+                                 "STMIA %1, {r3-r10}"
+                                 : : "r"(source), "r"(block) : "r3", "r4", "r5", "r6", "r7", "r8", "r9", "r10", "memory");
+            }
+
+            static void burst_fill(u32* dest, u32* end)
+            {
+                __asm__ volatile("MVN r3, #0\n\t"
+                                 "MOV r4, #0\n\t"
+                                 "MOV r5, r3\n\t"
+                                 "MOV r6, r4\n\t"
+                                 "MOV r7, r3\n\t"
+                                 "MOV r8, r4\n\t"
+                                 "MOV r9, r3\n\t"
+                                 "MOV r10, r4\n"
+                                 "1:\n\t"
+                                 "STMIA %0!, {r3-r10}\n\t"
+                                 "CMP %0, %1\n\t"
+                                 "BLO 1b"
+                                 : "+r"(dest) : "r"(end) : "r3", "r4", "r5", "r6", "r7", "r8", "r9", "r10", "cc", "memory");
+            }
+
+            static void burst_drain(const u32* source, const u32* end)
+            {
+                __asm__ volatile("1:\n\t"
+                                 "LDMIA %0!, {r3-r10}\n\t"
+                                 "CMP %0, %1\n\t"
+                                 "BLO 1b"
+                                 : "+r"(source) : "r"(end) : "r3", "r4", "r5", "r6", "r7", "r8", "r9", "r10", "cc", "memory");
+            }
+
+            static const u32 burst_test_offset = 16 * 1024 * 1024; // upper half of the area covered by the word tests
+            static const u32 burst_test_bytes = 64 * 1024;
+            static const u8 burst_test_dma_channel = 7;
+
+            u32 burst_ticks[32];
+        #else
+            bool run_burst_tests(u32 seed) { return true; }
+        #endif
+
         bool working_delays[32];
 
+        static const u8 min_delay = 1;
+        static const u8 max_delay = 30;
+        static const u8 verify_margin = 2;
+        static const u32 coarse_sections = 16;
+
         static const u8 dqs_delay_to_sensitivity[32];
     };
     
@@ -356,6 +727,15 @@ namespace emc
         {0, 0},
     };
 
+    // a data line stuck or a bit sampled off the DQS edge shows in the walking bit, and the alternating patterns toggle every line on every beat
+    template <typename DynamicMemoryTypeCS0_t>
+    const memory_test controller<DynamicMemoryTypeCS0_t>::coarse_test_vector[] =
+    {
+        {controller<DynamicMemoryTypeCS0_t>::walking_1_bit_setup, controller<DynamicMemoryTypeCS0_t>::walking_1_bit_check},
+        {controller<DynamicMemoryTypeCS0_t>::pattern_aa55_setup, controller<DynamicMemoryTypeCS0_t>::pattern_aa55_check},
+        {0, 0},
+    };
+
     template <typename DynamicMemoryTypeCS0_t>
     const u8 controller<DynamicMemoryTypeCS0_t>::dqs_delay_to_sensitivity[32] =
     {
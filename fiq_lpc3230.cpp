@@ -0,0 +1,158 @@
+#include "fiq_lpc3230.hpp"
+
+namespace lpc3230
+{
+
+namespace interrupt
+{
+
+namespace fiq
+{
+    namespace base_addr
+    {
+        enum en
+        {
+            mic = 0x40008000,
+            sic_1 = 0x4000C000,
+            sic_2 = 0x40010000,
+        };
+    }
+
+    namespace offset
+    {
+        enum en
+        {
+            enable = 0x00,
+            raw_status = 0x04,
+            status = 0x08,
+            polarity = 0x0C,
+            activation_type = 0x10,
+            interrupt_type = 0x14,
+        };
+    }
+
+    // the sub controllers forward their FIQ outputs to these main controller inputs, which are active low levels
+    static const u32 mic_sub_1_fiq = 0x40000000;
+    static const u32 mic_sub_2_fiq = 0x80000000;
+
+    struct handler_entry
+    {
+        volatile u32* status;
+        volatile u32* raw_status;
+        u32 mask;
+        bool edge;
+        fast_handler handler;
+        void* context;
+    };
+
+    static handler_entry handlers[max_handlers];
+    static u8 handler_count = 0;
+
+    // ids in LPC3200.h are numbered 0-31 for the main controller, 32-63 for sub controller 1 and 64-95 for sub controller 2
+    static volatile u32* get_register(id::en i, u32 reg_offset)
+    {
+        static const u32 controllers[] = {base_addr::mic, base_addr::sic_1, base_addr::sic_2};
+        return reinterpret_cast<volatile u32*>(controllers[static_cast<u32>(i) >> 5] + reg_offset);
+    }
+
+    static u32 get_mask(id::en i)
+    {
+        return 1 << (static_cast<u32>(i) & 0x1F);
+    }
+
+    #if ENABLE_FIQ_FAST_PATH
+        static const bool fast_path_enabled = true;
+    #else
+        static const bool fast_path_enabled = false; // the CTL FIQ handler keeps the vector, it would get a source nobody serves
+    #endif
+
+    bool install(id::en i, trigger::en t, fast_handler handler, void* context)
+    {
+        if (!fast_path_enabled || handler_count >= max_handlers || trigger::dual_edge == t)
+            return false;
+
+        u32 mask = get_mask(i);
+        bool edge = (trigger::negative_edge == t || trigger::positive_edge == t);
+
+        disable(i);
+
+        if (trigger::fixed != t)
+        {
+            if (trigger::high_level == t || trigger::positive_edge == t) *get_register(i, offset::polarity) |= mask;
+            else                                                          *get_register(i, offset::polarity) &= ~mask;
+            if (edge) *get_register(i, offset::activation_type) |= mask;
+            else      *get_register(i, offset::activation_type) &= ~mask;
+        }
+        *get_register(i, offset::interrupt_type) |= mask; // FIQ instead of IRQ
+
+        if (static_cast<u32>(i) >= 32)
+        {
+            // let the sub controller FIQ output through the main controller
+            u32 sub_mask = (static_cast<u32>(i) < 64) ? mic_sub_1_fiq : mic_sub_2_fiq;
+            volatile u32* mic = reinterpret_cast<volatile u32*>(base_addr::mic);
+            mic[offset::polarity / 4] &= ~sub_mask;
+            mic[offset::activation_type / 4] &= ~sub_mask;
+            mic[offset::interrupt_type / 4] |= sub_mask;
+            mic[offset::enable / 4] |= sub_mask;
+        }
+
+        if (edge)
+            *get_register(i, offset::raw_status) = mask; // forget any edge latched before we got here
+
+        handler_entry& entry = handlers[handler_count];
+        entry.status = get_register(i, offset::status);
+        entry.raw_status = get_register(i, offset::raw_status);
+        entry.mask = mask;
+        entry.edge = edge;
+        entry.handler = handler;
+        entry.context = context;
+        ++handler_count;
+
+        return true;
+    }
+
+    void enable(id::en i)
+    {
+        *get_register(i, offset::enable) |= get_mask(i);
+    }
+
+    void disable(id::en i)
+    {
+        *get_register(i, offset::enable) &= ~get_mask(i);
+    }
+
+    extern "C" void lpc3230_fiq_dispatch(u32 interrupted_pc)
+    {
+        for (u8 h = 0; h < handler_count; ++h)
+        {
+            handler_entry& entry = handlers[h];
+            if (*entry.status & entry.mask)
+            {
+                if (entry.edge)
+                    *entry.raw_status = entry.mask;
+                entry.handler(entry.context, interrupted_pc);
+            }
+        }
+    }
+
+    #if ENABLE_FIQ_FAST_PATH
+        // replaces the default FIQ vector of the startup code. r8-r12 are banked in FIQ mode, only the AAPCS scratch registers and lr need saving.
+        // 6 registers are pushed to keep the stack 8-byte aligned for the dispatcher.
+        extern "C" void fiq_handler() __attribute__ ((naked));
+        extern "C" void fiq_handler()
+        {
+            __asm__ volatile
+            (
+                "SUB   lr, lr, #4\n"
+                "STMFD sp!, {r0-r3, r12, lr}\n"
+                "MOV   r0, lr\n" // address of the interrupted instruction
+                "BL    lpc3230_fiq_dispatch\n"
+                "LDMFD sp!, {r0-r3, r12, pc}^\n" // return and restore CPSR from SPSR
+            );
+        }
+    #endif
+}
+
+}
+
+}
\ No newline at end of file
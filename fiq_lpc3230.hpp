@@ -0,0 +1,34 @@
+#pragma once
+
+#include "armtastic/types.hpp"
+#include "interrupt_lpc3230.hpp"
+
+// the FIQ fast path takes over the fiq_handler exception vector. when ENABLE_FIQ_FAST_PATH is set, do not route interrupts to
+// the CTL FIQ handler anymore (install_service_routine with fast = true), and make sure the startup code reserves a FIQ stack.
+
+namespace lpc3230
+{
+
+namespace interrupt
+{
+
+namespace fiq
+{
+    // a fast handler runs in FIQ mode, called straight from the exception vector : there is no CTL prologue, IRQs and FIQs are masked,
+    // and it receives the address of the interrupted instruction. it must not call any CTL or libarm routine.
+    // edge-triggered sources are cleared before the handler is called, level-triggered sources must be cleared by the handler itself.
+    typedef void (*fast_handler)(void* context, u32 interrupted_pc);
+
+    static const u8 max_handlers = 4; // every FIQ source is polled in order, keep this list short
+
+    // route interrupt i to the FIQ line, and have it served by handler. the source is left disabled.
+    // dual edge triggering is not supported by the interrupt controllers, install returns false in that case or when the handler table is full.
+    // it also returns false, leaving the source alone, when ENABLE_FIQ_FAST_PATH is not set.
+    bool install(id::en i, trigger::en t, fast_handler handler, void* context);
+    void enable(id::en i);
+    void disable(id::en i);
+}
+
+}
+
+}
\ No newline at end of file
@@ -0,0 +1,62 @@
+#pragma once
+
+// independent of the hardware, so host/fixed_ratio_test.cpp checks it against 128-bit division.
+// needs the u32 and u64 types of armtastic/types.hpp (the host tools declare their own) before inclusion.
+
+namespace lpc3230
+{
+
+namespace clock
+{
+    // multiplies by num / den without dividing : the ratio is kept as an integer part plus a 64-bit binary fraction,
+    // computed once. the product is then off by at most one, which a remainder computed in modulo 2^64 arithmetic detects.
+    // exact for any input, as long as the result itself fits in 64 bits.
+    class fixed_ratio
+    {
+    public:
+        fixed_ratio() : num(0), den(1), integer(0), fraction(0) {}
+
+        void set(u32 numerator, u32 denominator)
+        {
+            num = numerator;
+            den = denominator;
+            integer = num / den;
+            // fraction = floor(2^64 * (num % den) / den), in two 64 by 32 divisions
+            u64 r = static_cast<u64>(num % den) << 32;
+            u64 high = r / den;
+            u64 low = ((r % den) << 32) / den;
+            fraction = (high << 32) + low;
+        }
+
+        // floor(x * num / den)
+        u64 apply(u64 x) const
+        {
+            u64 q = x * integer + mul_high(x, fraction);
+            u64 remainder = x * num - q * den; // true value is below 2 * den, so the wrap-around in both products cancels out
+            if (remainder >= den)
+                ++q;
+            return q;
+        }
+
+    private:
+        // high half of the 128-bit product, from 32-bit limbs : the ARM926 has a 32x32->64 multiply, but no 64x64->128
+        static u64 mul_high(u64 a, u64 b)
+        {
+            u32 a_lo = static_cast<u32>(a), a_hi = static_cast<u32>(a >> 32);
+            u32 b_lo = static_cast<u32>(b), b_hi = static_cast<u32>(b >> 32);
+            u64 lo_lo = static_cast<u64>(a_lo) * b_lo;
+            u64 lo_hi = static_cast<u64>(a_lo) * b_hi;
+            u64 hi_lo = static_cast<u64>(a_hi) * b_lo;
+            u64 hi_hi = static_cast<u64>(a_hi) * b_hi;
+            u64 middle = (lo_lo >> 32) + static_cast<u32>(lo_hi) + static_cast<u32>(hi_lo);
+            return hi_hi + (lo_hi >> 32) + (hi_lo >> 32) + (middle >> 32);
+        }
+
+        u64 num;
+        u64 den;
+        u64 integer;
+        u64 fraction;
+    };
+}
+
+}
\ No newline at end of file
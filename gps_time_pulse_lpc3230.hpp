@@ -0,0 +1,253 @@
+#pragma once
+
+#include "armtastic/types.hpp"
+#include "interrupt_lpc3230.hpp"
+#include "fiq_lpc3230.hpp"
+#include "clock_lpc3230.hpp"
+#include "modules/init/globals.hpp"
+
+namespace lpc3230
+{
+
+namespace gps
+{
+    // the GPS time pulse (PPS) is stamped from the FIQ fast path : the system time is latched a few cycles after the edge,
+    // instead of after the CTL IRQ prologue and whatever IRQ handler happens to be running. without the fast path, an IRQ stamps it.
+    // from the stamps, discipline() keeps an estimate of the system clock rate and of the system time of the last GPS second,
+    // so samples can be converted to GPS time with a few multiplies, at the precision of the stamps (one periph_clock cycle).
+    class time_pulse
+    {
+    public:
+        time_pulse() : clock(0), pulse_count(0), pulse_time(0), processed_count(0), have_reference(false), reference_time(0), reference_second(0), labelled(false),
+                       rate_settled(false), rate(0), consecutive_outliers(0), outliers(0), active_estimate(0), publish_count(0) {}
+
+        // irq_priority only serves when the FIQ fast path is not available : keep it above the other IRQs, their run time lands in the stamps
+        void init(clock::controller& c, interrupt::trigger::en t = interrupt::trigger::positive_edge, u8 irq_priority = 0)
+        {
+            clock = &c;
+            pulse_count = 0;
+            processed_count = 0;
+            have_reference = false;
+            labelled = false;
+            rate_settled = false;
+            rate = static_cast<u64>(clock->get_periph_freq()) << 32;
+            consecutive_outliers = 0;
+            outliers = 0;
+            estimates[0].valid = false;
+            estimates[1].valid = false;
+            if (interrupt::fiq::install(interrupt::id::gps_time_pulse, t, fast_isr, this))
+                interrupt::fiq::enable(interrupt::id::gps_time_pulse);
+            else
+            {
+                get_int_ctrl().install_service_routine(interrupt::id::gps_time_pulse, irq_priority, false, t, irq_isr, this);
+                get_int_ctrl().enable_interrupt(interrupt::id::gps_time_pulse);
+            }
+        }
+
+        u32 get_pulse_count() { return pulse_count; }
+
+        // returns false if no pulse was received yet
+        bool get_last_pulse(u64& system_time, u32& count)
+        {
+            // the pulse count acts as a sequence number : retry if a pulse got stamped while we were copying the time
+            do
+            {
+                count = pulse_count;
+                system_time = pulse_time;
+            } while (count != pulse_count);
+            return count != 0;
+        }
+
+        // fold the pulses stamped since the last call into the estimate. call from a single task, at least once per second.
+        // that task is the only writer of the estimate : set_gps_second must be called from it too.
+        // returns true if a pulse was accepted.
+        bool discipline()
+        {
+            u64 time;
+            u32 count;
+            if (!get_last_pulse(time, count) || count == processed_count)
+                return false;
+            processed_count = count;
+
+            if (!have_reference)
+            {
+                take_reference(time, 0);
+                return true;
+            }
+
+            // whole seconds since the reference, using the current rate estimate. pulses missed in between are not a problem.
+            u64 period = time - reference_time;
+            u32 tps = static_cast<u32>(rate >> 32);
+            u64 seconds = (period + tps / 2) / tps;
+
+            if (seconds > max_measured_seconds) // the receiver lost its fix for a long while : start over from this pulse, keeping the rate
+            {
+                labelled = false;
+                take_reference(time, 0);
+                return true;
+            }
+
+            u64 measured = seconds ? (period << 32) / seconds : 0; // 32.32 ticks per second
+            u64 tolerance = rate >> outlier_shift;
+            if (!seconds || measured > rate + tolerance || measured < rate - tolerance)
+            {
+                // a glitch on the line, or a pulse stamped late. the reference is kept, so the next good pulse is still a whole number of seconds away.
+                ++outliers;
+                if (++consecutive_outliers >= max_consecutive_outliers) // it is not a glitch, our clock moved : re-acquire
+                {
+                    labelled = false;
+                    rate_settled = false;
+                    rate = static_cast<u64>(clock->get_periph_freq()) << 32;
+                    take_reference(time, 0);
+                }
+                return false;
+            }
+
+            consecutive_outliers = 0;
+            if (rate_settled)
+                rate += (static_cast<s64>(measured - rate)) >> filter_shift;
+            else
+            {
+                rate = measured;
+                rate_settled = true;
+            }
+            take_reference(time, seconds);
+            return true;
+        }
+
+        // the receiver tells us, in a message sent after the pulse, which GPS second the last pulse marked.
+        // gps time is only available once a pulse has been labelled. call from the task calling discipline().
+        void set_gps_second(u64 second)
+        {
+            reference_second = second;
+            labelled = true;
+            publish();
+        }
+
+        // converts a system time to GPS time in nanoseconds. returns false until the estimate is available.
+        // cheap and safe from any context : reads a published snapshot of the estimate, no division.
+        bool system_to_gps_nanosec(u64 system_time, u64& gps_nanosec)
+        {
+            // the publish count acts as a sequence number : a reader preempted for two publishes may have copied a slot being rewritten
+            estimate e;
+            u32 sequence;
+            do
+            {
+                sequence = publish_count;
+                __asm__ volatile("" : : : "memory"); // the copy stays between the two reads of the count
+                e = estimates[active_estimate];
+                __asm__ volatile("" : : : "memory");
+            } while (sequence != publish_count);
+
+            if (!e.valid)
+                return false;
+
+            if (system_time >= e.reference_time)
+                gps_nanosec = e.reference_nanosec + ticks_to_nanosec(system_time - e.reference_time, e.nanosec_per_tick);
+            else
+                gps_nanosec = e.reference_nanosec - ticks_to_nanosec(e.reference_time - system_time, e.nanosec_per_tick);
+            return true;
+        }
+
+        // estimated periph_clock frequency, in 32.32 fixed point Hz
+        u64 get_rate() { return rate; }
+        u32 get_outlier_count() { return outliers; }
+
+    private:
+        struct estimate
+        {
+            bool valid;
+            u64 reference_time; // system time of the last accepted pulse
+            u64 reference_nanosec; // its GPS time
+            u64 nanosec_per_tick; // 32.32 fixed point
+        };
+
+        void take_reference(u64 time, u64 seconds)
+        {
+            reference_time = time;
+            reference_second += seconds;
+            have_reference = true;
+            publish();
+        }
+
+        // single writer, the task calling discipline() : the estimate not in use is filled, then swapped in with one store.
+        // a reader preempting us keeps the previous one, and the publish count tells a reader preempted for longer to retry.
+        void publish()
+        {
+            u8 next = active_estimate ^ 1;
+            estimate& e = estimates[next];
+            e.valid = labelled && rate_settled;
+            e.reference_time = reference_time;
+            e.reference_nanosec = reference_second * 1000000000ULL;
+            e.nanosec_per_tick = divide_shifted(1000000000ULL, rate); // 1e9 * 2^64 / rate, or nanoseconds per tick in 32.32
+            __asm__ volatile("" : : : "memory"); // the slot is complete before it gets swapped in
+            active_estimate = next;
+            ++publish_count;
+        }
+
+        // (high * 2^64) / divisor, for high below divisor. bitwise, but only run once per pulse.
+        static u64 divide_shifted(u64 high, u64 divisor)
+        {
+            u64 quotient = 0;
+            u64 remainder = high;
+            for (u8 i = 0; i < 64; ++i)
+            {
+                bool carry = (remainder >> 63) != 0;
+                remainder <<= 1;
+                quotient <<= 1;
+                if (carry || remainder >= divisor)
+                {
+                    remainder -= divisor;
+                    quotient |= 1;
+                }
+            }
+            return quotient;
+        }
+
+        // (ticks * nanosec_per_tick) >> 32, from 32-bit limbs so it does not overflow
+        static u64 ticks_to_nanosec(u64 ticks, u64 nanosec_per_tick)
+        {
+            u32 ticks_lo = static_cast<u32>(ticks), ticks_hi = static_cast<u32>(ticks >> 32);
+            u32 npt_lo = static_cast<u32>(nanosec_per_tick);
+            u64 npt_hi = nanosec_per_tick >> 32;
+            return ticks * npt_hi + static_cast<u64>(ticks_hi) * npt_lo + ((static_cast<u64>(ticks_lo) * npt_lo) >> 32);
+        }
+
+        static void fast_isr(void* context, u32 interrupted_pc)
+        {
+            time_pulse* self = static_cast<time_pulse*>(context);
+            self->pulse_time = self->clock->get_system_time();
+            ++self->pulse_count;
+        }
+
+        static void irq_isr(void* context)
+        {
+            fast_isr(context, 0);
+        }
+
+        static const u8 filter_shift = 3; // the rate follows measurements with a time constant of 8 seconds
+        static const u8 outlier_shift = 13; // pulses more than 122 ppm away from the rate estimate are rejected
+        static const u8 max_consecutive_outliers = 4;
+        static const u64 max_measured_seconds = 300; // the period must stay representable in 32.32, and the counter difference unambiguous
+
+        clock::controller* clock;
+        volatile u32 pulse_count;
+        volatile u64 pulse_time;
+
+        u32 processed_count;
+        bool have_reference;
+        u64 reference_time;
+        u64 reference_second;
+        bool labelled;
+        bool rate_settled;
+        u64 rate; // 32.32 fixed point ticks per second
+        u8 consecutive_outliers;
+        u32 outliers;
+
+        estimate estimates[2];
+        volatile u8 active_estimate;
+        volatile u32 publish_count;
+    };
+}
+
+}
\ No newline at end of file
@@ -0,0 +1,107 @@
+// checks clock::fixed_ratio (fixed_ratio.hpp) against 128-bit integer division, for the conversions clock::controller sets up :
+// periph_clock ticks to seconds, milliseconds, microseconds and nanoseconds. every input whose result fits in 64 bits must convert
+// exactly : edge values around multiples of the clock, around powers of two and around the largest input, then random ones.
+//
+// build : g++ -O2 -o fixed_ratio_test fixed_ratio_test.cpp
+// usage : fixed_ratio_test [random_count] [seed]
+// exits with 1 on the first mismatch.
+
+#include <cstdio>
+#include <cstdlib>
+
+typedef unsigned char u8;
+typedef unsigned short u16;
+typedef unsigned int u32;
+typedef unsigned long long u64;
+typedef unsigned __int128 u128;
+
+#include "../fixed_ratio.hpp"
+
+using namespace lpc3230;
+
+// periph_clock values the clock configurations allow : the 13 MHz oscillator and the ARM clock divided by 1 to 32, up to 20 MHz
+static const u32 periph_freqs[] = { 13000000, 6500000, 4333333, 3250000, 1000000, 10000000, 12000000, 16000000, 19500000, 20000000, 1, 7, 32768 };
+static const u32 numerators[] = { 1, 1000, 1000000, 1000000000 };
+
+// xorshift64*, the host rand() is too short for 64-bit inputs
+static u64 random_state;
+static u64 next_random()
+{
+    random_state ^= random_state >> 12;
+    random_state ^= random_state << 25;
+    random_state ^= random_state >> 27;
+    return random_state * 2685821657736338717ULL;
+}
+
+static u64 checked;
+
+static bool check(const clock::fixed_ratio& ratio, u32 num, u32 den, u64 x)
+{
+    u128 expected = static_cast<u128>(x) * num / den;
+    if (expected >> 64)
+        return true; // out of the contract : the result does not fit
+    ++checked;
+    u64 got = ratio.apply(x);
+    if (got == static_cast<u64>(expected))
+        return true;
+    printf("mismatch : %llu * %u / %u = %llu, got %llu\n", x, num, den, static_cast<u64>(expected), got);
+    return false;
+}
+
+// x - 2 .. x + 2, without wrapping
+static bool check_around(const clock::fixed_ratio& ratio, u32 num, u32 den, u64 x)
+{
+    for (int d = -2; d <= 2; ++d)
+    {
+        if ((d < 0 && x < static_cast<u64>(-d)) || (d > 0 && x > ~0ULL - d))
+            continue;
+        if (!check(ratio, num, den, x + d))
+            return false;
+    }
+    return true;
+}
+
+int main(int argc, char* argv[])
+{
+    u64 random_count = (argc > 1) ? strtoull(argv[1], 0, 0) : 1000000;
+    random_state = (argc > 2) ? strtoull(argv[2], 0, 0) : 0x9E3779B97F4A7C15ULL;
+    if (!random_state)
+        random_state = 1;
+
+    for (u32 f = 0; f < sizeof(periph_freqs) / sizeof(periph_freqs[0]); ++f)
+    {
+        for (u32 n = 0; n < sizeof(numerators) / sizeof(numerators[0]); ++n)
+        {
+            const u32 den = periph_freqs[f];
+            const u32 num = numerators[n];
+            clock::fixed_ratio ratio;
+            ratio.set(num, den);
+
+            // the largest input whose result still fits in 64 bits
+            u128 limit = ((static_cast<u128>(1) << 64) * den - 1) / num;
+            const u64 max_x = (limit >> 64) ? ~0ULL : static_cast<u64>(limit);
+
+            bool ok = check_around(ratio, num, den, 0) && check_around(ratio, num, den, max_x) && check_around(ratio, num, den, max_x / 2);
+            for (u32 bit = 1; ok && bit < 64; ++bit)
+                ok = check_around(ratio, num, den, 1ULL << bit);
+            for (u64 k = 1; ok && k <= 1000; ++k)
+                ok = check_around(ratio, num, den, k * den);
+            for (u64 k = 1; ok && k <= 64 && k * den <= max_x / 2; k *= 2) // multiples of the clock up to the largest input
+                ok = check_around(ratio, num, den, max_x / (k * den) * (k * den));
+
+            // random magnitudes : a random bit length first, so small inputs get checked as often as large ones
+            for (u64 r = 0; ok && r < random_count; ++r)
+            {
+                u32 bits = static_cast<u32>(next_random() % 64) + 1;
+                u64 x = next_random() >> (64 - bits);
+                ok = check(ratio, num, den, (x > max_x) ? x % (max_x + 1) : x);
+            }
+
+            if (!ok)
+                return 1;
+        }
+    }
+
+    printf("%llu conversions exact\n", checked);
+    return 0;
+}
\ No newline at end of file
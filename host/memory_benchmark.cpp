@@ -0,0 +1,222 @@
+// runs the memory benchmark harness (memory_benchmark.hpp) on the host, against a model of the board : timer 0 counting at the
+// peripheral clock and a DMA channel moving at most one 12-bit transfer count per run. there is no model of the EMC AHB arbitration :
+// the profiles are stand-ins with the same effect on the host, so the arbitration pass only checks the harness walks and restores them.
+// checks the harness logic and the report format, the figures are those of the host.
+//
+// build : g++ -O2 -o memory_benchmark memory_benchmark.cpp
+// usage : memory_benchmark [periph_clock_hz]
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <time.h>
+
+typedef unsigned char u8;
+typedef unsigned short u16;
+typedef unsigned int u32;
+typedef unsigned long long u64;
+
+#include "../memory_benchmark.hpp"
+
+using namespace lpc3230;
+
+// timer 0 : free-running, no prescaler, counts the peripheral clock
+struct timer_model
+{
+    u32 periph_clock;
+
+    u32 tc()
+    {
+        timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        return static_cast<u32>(static_cast<u64>(now.tv_sec) * periph_clock + static_cast<u64>(now.tv_nsec) * periph_clock / 1000000000ULL); // wraps like the counter
+    }
+};
+
+// one DMA channel, memory to memory, 32-bit transfers : what start_copy programs. moves one burst per look at the enable bit,
+// so a transfer spans several polls like on the board
+struct dma_channel_model
+{
+    const u32* source_address;
+    u32* dest_address;
+    u32 transfer_size; // 12 bits in the channel control register
+    bool enable;
+
+    bool poll()
+    {
+        if (!enable)
+            return false;
+        u32 burst = (transfer_size & 0xFFF) < 8 ? (transfer_size & 0xFFF) : 8;
+        memcpy(dest_address, source_address, burst * 4);
+        source_address += burst;
+        dest_address += burst;
+        transfer_size -= burst;
+        if (!(transfer_size & 0xFFF))
+            enable = false; // the channel disables itself at the terminal count
+        return enable;
+    }
+};
+
+class host_board
+{
+public:
+    host_board(u32 periph_clock) : sink(0)
+    {
+        timer.periph_clock = periph_clock;
+        memset(&channel, 0, sizeof(channel));
+        set_arbitration_profile(0);
+    }
+
+    u32 tick_frequency() { return timer.periph_clock; }
+    u32 ticks() { return timer.tc(); }
+
+    void sync(u32* start, u32* end) {} // no cache maintenance to model, the host caches stay warm
+
+    void read(const u32* start, const u32* end)
+    {
+        u32 sum = 0;
+        for (const volatile u32* p = start; p < end; ++p)
+            sum += *p;
+        sink += sum;
+    }
+
+    void write(u32* start, u32* end)
+    {
+        for (volatile u32* p = start; p < end; ++p)
+            *p = 0;
+    }
+
+    void copy(const u32* source, u32* dest, u32 words)
+    {
+        memcpy(dest, source, words * 4);
+    }
+
+    // the chunking of dma::controller::copy_polled, on the channel model
+    bool dma_copy(const u32* source, u32* dest, u32 words)
+    {
+        while (words)
+        {
+            u32 chunk = (words > max_copy_words) ? max_copy_words : words;
+            dma_start(source, dest, chunk);
+            while (dma_busy());
+            source += chunk;
+            dest += chunk;
+            words -= chunk;
+        }
+        return true;
+    }
+
+    // stand-ins for the emc profiles : selecting one changes nothing on the host
+    u8 arbitration_profile_count() { return sizeof(profile_names) / sizeof(profile_names[0]); }
+    const char* arbitration_profile_name(u8 p) { return profile_names[p]; }
+    u8 get_arbitration_profile() { return profile; }
+    void set_arbitration_profile(u8 p) { profile = p; }
+
+    u32 dma_max_words() { return max_copy_words; }
+
+    void dma_start(const u32* source, u32* dest, u32 words)
+    {
+        if (words > max_copy_words)
+        {
+            fprintf(stderr, "dma_start : %u words over the transfer count\n", words);
+            exit(1);
+        }
+        channel.source_address = source;
+        channel.dest_address = dest;
+        channel.transfer_size = words;
+        channel.enable = true;
+    }
+
+    bool dma_busy() { return channel.poll(); }
+    bool dma_failed() { return false; }
+
+    u32 sink;
+
+private:
+    static const char* const profile_names[3];
+    static const u32 max_copy_words = 0xFF8;
+
+    timer_model timer;
+    dma_channel_model channel;
+    u8 profile;
+};
+
+const char* const host_board::profile_names[3] = { "host_0", "host_1", "host_2" };
+
+// the uart side : drains the client like the transmit interrupt does
+struct stdout_uart
+{
+    uart_client* client;
+
+    void set_client(uart_client& c) { client = &c; }
+
+    void trigger_transmit()
+    {
+        u8 byte;
+        while (client->get_byte(0))
+        {
+            client->get_byte(&byte);
+            putchar(byte);
+        }
+    }
+};
+
+// the copies must have moved the source half of each region exactly
+static bool check_copy(const benchmark::region* regions, u32 count)
+{
+    for (u32 r = 0; r < count; ++r)
+    {
+        u32 words = (regions[r].bytes / 8) & ~0x7;
+        if (memcmp(regions[r].base, regions[r].base + words, words * 4))
+        {
+            fprintf(stderr, "%s : copy mismatch\n", regions[r].name);
+            return false;
+        }
+    }
+    return true;
+}
+
+int main(int argc, char** argv)
+{
+    u32 periph_clock = (argc > 1) ? strtoul(argv[1], 0, 0) : 13000000;
+    if (!periph_clock)
+    {
+        fprintf(stderr, "usage : %s [periph_clock_hz]\n", argv[0]);
+        return 1;
+    }
+
+    // same sizes as the board buffers
+    static const u32 iram_bytes = 32 * 1024;
+    static const u32 ddr_bytes = 512 * 1024;
+    u32* iram = static_cast<u32*>(calloc(iram_bytes, 1));
+    u32* ddr = static_cast<u32*>(calloc(ddr_bytes, 1));
+    u32* ddr_no_cache = static_cast<u32*>(calloc(ddr_bytes, 1));
+    if (!iram || !ddr || !ddr_no_cache)
+        return 1;
+
+    const benchmark::region regions[] =
+    {
+        { "iram", iram, iram_bytes, true },
+        { "ddr_cached", ddr, ddr_bytes, true },
+        { "ddr_uncached", ddr_no_cache, ddr_bytes, true },
+    };
+
+    host_board board(periph_clock);
+    benchmark::suite<host_board> suite(board);
+    suite.run(regions, sizeof(regions) / sizeof(regions[0]));
+    if (!check_copy(regions, sizeof(regions) / sizeof(regions[0])))
+        return 1;
+
+    // the chase overwrites its region, only the DMA one can be checked
+    suite.run_arbitration(regions[2], regions[1]);
+    if (!check_copy(&regions[2], 1))
+        return 1;
+
+    stdout_uart uart;
+    suite.report(uart);
+
+    free(iram);
+    free(ddr);
+    free(ddr_no_cache);
+    return 0;
+}
\ No newline at end of file
@@ -0,0 +1,379 @@
+// builds MMU layouts with the code install_page_tables runs on the board (page_table_builder_arm926ejs.hpp), then checks and decodes them :
+// holes, overlaps, misaligned ranges and physical addresses, second level tables out of place, and the resulting mapping per region
+// with its cache policy. given two layouts, also lists every address range they translate differently.
+//
+// build : g++ -O2 -I. -o page_table_check page_table_check.cpp
+// usage : page_table_check [-t table_address] layout [other_layout]
+//
+// a layout file holds the rows of the instruction arrays, one per line, as they are written in the firmware :
+//   { 0x00000000, 0x000FFFFF, 0x00000000, first_level_descriptor_type::coarse, false, false, access_permission::priv_rw_user_rw, 0 },
+//   { 0x00000000, 0x00000FFF, 0x00000000, second_level_descriptor_size::small, false, false, access_permission::priv_rw_user_ro, ... },
+// rows of 8 fields are first level instructions, rows of 10 fields second level ones, in file order. lines not starting with a number
+// (declarations, braces, comments) are skipped, so the firmware source can be fed as is when it holds a single layout.
+// table_address is where the MMU sees the table, 0x08000000 (IRAM) by default : it only shows in the second level descriptors.
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "../page_table_builder_arm926ejs.hpp"
+
+using namespace arm926ejs;
+
+struct layout
+{
+    std::string name;
+    std::vector<first_level_instruction> first_level;
+    std::vector<second_level_instruction> second_level;
+    std::vector<u32> table;
+    u32 errors;
+};
+
+static bool parse_number(const std::string& token, u32& value)
+{
+    char* end;
+    unsigned long v = strtoul(token.c_str(), &end, 0);
+    if (token.empty() || *end)
+        return false;
+    value = static_cast<u32>(v);
+    return true;
+}
+
+// a number, or the enumerator / boolean name, with or without its namespaces
+static bool parse_field(const std::string& token, const char* const* names, u32 name_count, u32& value)
+{
+    if (parse_number(token, value))
+        return true;
+    std::string name = token;
+    std::string::size_type scope = name.rfind("::");
+    if (scope != std::string::npos)
+        name = name.substr(scope + 2);
+    for (u32 n = 0; n < name_count; ++n)
+    {
+        if (name == names[n])
+        {
+            value = n;
+            return true;
+        }
+    }
+    return false;
+}
+
+static const char* const boolean_names[] = { "false", "true" };
+static const char* const first_level_type_names[] = { "fault", "coarse", "section", "fine" };
+static const char* const second_level_size_names[] = { "fault", "large", "small", "tiny" };
+static const char* const access_names[] = { "use_s_r", "priv_rw_user_no_access", "priv_rw_user_ro", "priv_rw_user_rw" };
+
+static bool load_layout(const char* path, layout& l)
+{
+    FILE* file = fopen(path, "r");
+    if (!file)
+    {
+        fprintf(stderr, "could not open %s\n", path);
+        return false;
+    }
+    l.name = path;
+
+    char line[1024];
+    u32 line_number = 0;
+    bool ok = true;
+    while (fgets(line, sizeof(line), file))
+    {
+        ++line_number;
+        std::string text = line;
+        std::string::size_type comment = text.find("//");
+        if (comment != std::string::npos)
+            text.erase(comment);
+        comment = text.find('#');
+        if (comment != std::string::npos)
+            text.erase(comment);
+        for (std::string::size_type c = 0; c < text.size(); ++c)
+        {
+            if (text[c] == '{' || text[c] == '}' || text[c] == ',' || text[c] == ';' || text[c] == '\t' || text[c] == '\r' || text[c] == '\n')
+                text[c] = ' ';
+        }
+
+        std::vector<std::string> tokens;
+        std::string::size_type pos = 0;
+        while (true)
+        {
+            pos = text.find_first_not_of(' ', pos);
+            if (pos == std::string::npos)
+                break;
+            std::string::size_type end = text.find(' ', pos);
+            tokens.push_back(text.substr(pos, (end == std::string::npos) ? std::string::npos : end - pos));
+            pos = end;
+        }
+
+        u32 first;
+        if (tokens.empty() || !parse_number(tokens[0], first))
+            continue;
+
+        u32 f[10];
+        bool parsed = parse_number(tokens[0], f[0]);
+        if (tokens.size() == 8)
+        {
+            parsed = parsed && parse_number(tokens[1], f[1]) && parse_number(tokens[2], f[2]) &&
+                     parse_field(tokens[3], first_level_type_names, 4, f[3]) && parse_field(tokens[4], boolean_names, 2, f[4]) &&
+                     parse_field(tokens[5], boolean_names, 2, f[5]) && parse_field(tokens[6], access_names, 4, f[6]) && parse_number(tokens[7], f[7]);
+            if (parsed && f[3] <= 3 && f[6] <= 3)
+            {
+                first_level_instruction inst = { f[0], f[1], f[2], static_cast<first_level_descriptor_type::en>(f[3]), f[4] != 0, f[5] != 0,
+                                                 static_cast<access_permission::en>(f[6]), static_cast<u8>(f[7]) };
+                if (f[7] <= 15)
+                {
+                    l.first_level.push_back(inst);
+                    continue;
+                }
+                fprintf(stderr, "%s:%u : domain %u out of 0..15\n", path, line_number, f[7]);
+                ok = false;
+                continue;
+            }
+        }
+        else if (tokens.size() == 10)
+        {
+            parsed = parsed && parse_number(tokens[1], f[1]) && parse_number(tokens[2], f[2]) &&
+                     parse_field(tokens[3], second_level_size_names, 4, f[3]) && parse_field(tokens[4], boolean_names, 2, f[4]) &&
+                     parse_field(tokens[5], boolean_names, 2, f[5]);
+            for (u32 a = 6; parsed && a < 10; ++a)
+                parsed = parse_field(tokens[a], access_names, 4, f[a]) && f[a] <= 3;
+            if (parsed && f[3] <= 3)
+            {
+                second_level_instruction inst = { f[0], f[1], f[2], static_cast<second_level_descriptor_size::en>(f[3]), f[4] != 0, f[5] != 0,
+                                                  static_cast<access_permission::en>(f[6]), static_cast<access_permission::en>(f[7]),
+                                                  static_cast<access_permission::en>(f[8]), static_cast<access_permission::en>(f[9]) };
+                l.second_level.push_back(inst);
+                continue;
+            }
+        }
+        fprintf(stderr, "%s:%u : not an instruction row\n", path, line_number);
+        ok = false;
+    }
+    fclose(file);
+
+    if (ok && l.first_level.empty())
+    {
+        fprintf(stderr, "%s : no first level instruction\n", path);
+        ok = false;
+    }
+    return ok;
+}
+
+struct error_printer
+{
+    const layout* l;
+    u32 count;
+
+    void operator()(page_table_error::en error, u32 index)
+    {
+        ++count;
+        u32 first_level_size = l->first_level.size();
+        if (index < first_level_size)
+        {
+            const first_level_instruction& inst = l->first_level[index];
+            printf("  error : first level %u (%08x-%08x) : %s\n", index, inst.start_addr, inst.end_addr, get_page_table_error_name(error));
+        }
+        else if (index - first_level_size < l->second_level.size())
+        {
+            const second_level_instruction& inst = l->second_level[index - first_level_size];
+            printf("  error : second level %u (%08x-%08x) : %s\n", index - first_level_size, inst.start_addr, inst.end_addr, get_page_table_error_name(error));
+        }
+        else
+        {
+            printf("  error : table : %s\n", get_page_table_error_name(error));
+        }
+    }
+};
+
+static void build_layout(layout& l, u32 table_address)
+{
+    printf("%s : %u first level, %u second level instructions\n", l.name.c_str(), (u32)l.first_level.size(), (u32)l.second_level.size());
+
+    l.table.assign(get_page_table_entries(&l.first_level[0], l.first_level.size()), 0);
+    error_printer report = { &l, 0 };
+    build_page_tables(&l.table[0], table_address, &l.first_level[0], l.first_level.size(),
+                      l.second_level.empty() ? 0 : &l.second_level[0], l.second_level.size(), report);
+    l.errors = report.count;
+
+    printf("  %u entries, %u bytes at %08x, %u error%s\n", (u32)l.table.size(), (u32)l.table.size() * 4, table_address, l.errors, (l.errors == 1) ? "" : "s");
+}
+
+// the ARM926EJ-S data cache policy of the C and B bits
+static const char* cache_policy(const translation& t)
+{
+    if (t.cacheable)
+        return t.bufferable ? "write-back" : "write-through";
+    return t.bufferable ? "bufferable" : "uncached";
+}
+
+static const char* access_name(access_permission::en access)
+{
+    switch (access)
+    {
+    case access_permission::use_s_r:                return "s/r";
+    case access_permission::priv_rw_user_no_access: return "rw/--";
+    case access_permission::priv_rw_user_ro:        return "rw/ro";
+    default:                                        return "rw/rw";
+    }
+}
+
+static const char* kind_name(const translation& t)
+{
+    if (first_level_descriptor_type::section == t.type)
+        return "section";
+    if (first_level_descriptor_type::fault == t.type)
+        return "fault";
+    static const char* const pages[] = { "fault", "large", "small", "tiny" };
+    return pages[t.page];
+}
+
+static bool is_fault(const translation& t)
+{
+    return first_level_descriptor_type::fault == t.type || (first_level_descriptor_type::section != t.type && second_level_descriptor_size::fault == t.page);
+}
+
+// both translate alike, the second continuing the physical range of the first
+static bool same_mapping(const translation& a, u32 a_addr, const translation& b, u32 b_addr, bool same_kind)
+{
+    if (is_fault(a) || is_fault(b))
+        return is_fault(a) && is_fault(b);
+    if (same_kind && (a.type != b.type || a.page != b.page))
+        return false;
+    return a.physical_addr + (a_addr - a.virtual_addr) + (b_addr - a_addr) == b.physical_addr + (b_addr - b.virtual_addr) &&
+           a.cacheable == b.cacheable && a.bufferable == b.bufferable && a.access == b.access && a.domain_index == b.domain_index;
+}
+
+static void print_mapping(const translation& t, u32 addr)
+{
+    if (is_fault(t))
+        printf("%-8s", "fault");
+    else
+        printf("%08x %-13s %-5s d%-2u", t.physical_addr + (addr - t.virtual_addr), cache_policy(t), access_name(t.access), t.domain_index);
+}
+
+static bool translate_at(const layout& l, u32 table_address, u32 addr, translation& t)
+{
+    if (translate(&l.table[0], table_address, l.table.size(), addr, t))
+        return true;
+    printf("  error : %08x : second level table outside of the table\n", addr);
+    t.type = first_level_descriptor_type::fault;
+    t.size = 0x100000;
+    t.virtual_addr = addr & 0xfff00000;
+    return false;
+}
+
+static void dump_layout(const layout& l, u32 table_address)
+{
+    printf("  %-17s  %-7s  %-8s %-13s %-5s %s\n", "virtual", "pages", "physical", "cache", "ap", "domain");
+
+    u64 addr = 0;
+    while (addr < 0x100000000ULL)
+    {
+        translation start;
+        translate_at(l, table_address, static_cast<u32>(addr), start);
+        u64 end = static_cast<u64>(start.virtual_addr) + start.size;
+        while (end < 0x100000000ULL)
+        {
+            translation next;
+            translate_at(l, table_address, static_cast<u32>(end), next);
+            if (!same_mapping(start, static_cast<u32>(addr), next, static_cast<u32>(end), true))
+                break;
+            end = static_cast<u64>(next.virtual_addr) + next.size;
+        }
+        printf("  %08x-%08x  %-7s  ", static_cast<u32>(addr), static_cast<u32>(end - 1), kind_name(start));
+        print_mapping(start, static_cast<u32>(addr));
+        printf("\n");
+        addr = end;
+    }
+}
+
+static u32 diff_layouts(const layout& a, const layout& b, u32 table_address)
+{
+    printf("differences %s -> %s :\n", a.name.c_str(), b.name.c_str());
+
+    u32 differences = 0;
+    u64 addr = 0;
+    while (addr < 0x100000000ULL)
+    {
+        translation ta, tb;
+        translate_at(a, table_address, static_cast<u32>(addr), ta);
+        translate_at(b, table_address, static_cast<u32>(addr), tb);
+        u64 end_a = static_cast<u64>(ta.virtual_addr) + ta.size;
+        u64 end_b = static_cast<u64>(tb.virtual_addr) + tb.size;
+        u64 end = (end_a < end_b) ? end_a : end_b;
+
+        if (same_mapping(ta, static_cast<u32>(addr), tb, static_cast<u32>(addr), false))
+        {
+            addr = end;
+            continue;
+        }
+
+        // extend while both sides keep differing the same way
+        while (end < 0x100000000ULL)
+        {
+            translation na, nb;
+            translate_at(a, table_address, static_cast<u32>(end), na);
+            translate_at(b, table_address, static_cast<u32>(end), nb);
+            if (!same_mapping(ta, static_cast<u32>(addr), na, static_cast<u32>(end), false) ||
+                !same_mapping(tb, static_cast<u32>(addr), nb, static_cast<u32>(end), false))
+                break;
+            end_a = static_cast<u64>(na.virtual_addr) + na.size;
+            end_b = static_cast<u64>(nb.virtual_addr) + nb.size;
+            end = (end_a < end_b) ? end_a : end_b;
+        }
+
+        ++differences;
+        printf("  %08x-%08x  ", static_cast<u32>(addr), static_cast<u32>(end - 1));
+        print_mapping(ta, static_cast<u32>(addr));
+        printf("  ->  ");
+        print_mapping(tb, static_cast<u32>(addr));
+        printf("\n");
+        addr = end;
+    }
+
+    if (!differences)
+        printf("  none, both translate every address alike\n");
+    return differences;
+}
+
+int main(int argc, char* argv[])
+{
+    u32 table_address = 0x08000000;
+    int arg = 1;
+    if (arg + 1 < argc && !strcmp(argv[arg], "-t"))
+    {
+        if (!parse_number(argv[arg + 1], table_address))
+        {
+            fprintf(stderr, "bad table address %s\n", argv[arg + 1]);
+            return 1;
+        }
+        arg += 2;
+    }
+    if (argc - arg < 1 || argc - arg > 2)
+    {
+        fprintf(stderr, "usage : %s [-t table_address] layout [other_layout]\n", argv[0]);
+        return 1;
+    }
+
+    std::vector<layout> layouts(argc - arg);
+    for (u32 l = 0; l < layouts.size(); ++l)
+    {
+        if (!load_layout(argv[arg + l], layouts[l]))
+            return 1;
+    }
+
+    u32 errors = 0;
+    for (u32 l = 0; l < layouts.size(); ++l)
+    {
+        build_layout(layouts[l], table_address);
+        dump_layout(layouts[l], table_address);
+        errors += layouts[l].errors;
+    }
+
+    if (layouts.size() == 2)
+        diff_layouts(layouts[0], layouts[1], table_address);
+
+    return errors ? 2 : 0;
+}
\ No newline at end of file
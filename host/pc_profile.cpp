@@ -0,0 +1,205 @@
+// flat profile from a capture of the pc_sampler stream (see pc_sampler_lpc3230.hpp), against the symbols of the firmware ELF.
+//
+// build : g++ -O2 -o pc_profile pc_profile.cpp
+// usage : pc_profile capture.bin firmware.elf [top_count]
+//
+// the symbols are read from the output of nm, arm-none-eabi-nm by default. set the NM environment variable to use another one.
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <map>
+#include <algorithm>
+
+typedef unsigned char u8;
+typedef unsigned short u16;
+typedef unsigned int u32;
+
+namespace record
+{
+    enum en
+    {
+        start = 0xA4,
+        sample = 0xA5,
+        task = 0xA6,
+        overflow = 0xA7,
+    };
+}
+
+struct symbol
+{
+    u32 address;
+    std::string name;
+
+    bool operator<(const symbol& other) const { return address < other.address; }
+};
+
+struct entry
+{
+    std::string name;
+    u32 count;
+
+    bool operator<(const entry& other) const { return count > other.count; }
+};
+
+static bool load_symbols(const char* elf, std::vector<symbol>& symbols)
+{
+    const char* nm = getenv("NM");
+    std::string command = std::string(nm ? nm : "arm-none-eabi-nm") + " -n -C --defined-only \"" + elf + "\"";
+    FILE* pipe = popen(command.c_str(), "r");
+    if (!pipe)
+        return false;
+
+    char line[4096];
+    while (fgets(line, sizeof(line), pipe))
+    {
+        char* end;
+        u32 address = strtoul(line, &end, 16);
+        if (end == line || *end != ' ')
+            continue;
+        char type = end[1];
+        if (type != 't' && type != 'T' && type != 'w' && type != 'W') // code only
+            continue;
+        std::string name(end + 3);
+        while (!name.empty() && (name[name.size() - 1] == '\n' || name[name.size() - 1] == '\r'))
+            name.erase(name.size() - 1);
+        if (name.empty() || name[0] == '$') // arm mapping symbols
+            continue;
+
+        symbol s;
+        s.address = address;
+        s.name = name;
+        symbols.push_back(s);
+    }
+
+    std::stable_sort(symbols.begin(), symbols.end());
+    return pclose(pipe) == 0 && !symbols.empty();
+}
+
+static const std::string& lookup(const std::vector<symbol>& symbols, u32 pc)
+{
+    static const std::string unknown("<unknown>");
+    symbol key;
+    key.address = pc;
+    std::vector<symbol>::const_iterator it = std::upper_bound(symbols.begin(), symbols.end(), key);
+    if (it == symbols.begin())
+        return unknown;
+    return (--it)->name;
+}
+
+static u32 read_u32(const std::vector<u8>& data, size_t pos)
+{
+    return data[pos] | (data[pos + 1] << 8) | (data[pos + 2] << 16) | (static_cast<u32>(data[pos + 3]) << 24);
+}
+
+static void print_table(const char* title, std::map<std::string, u32>& counts, u32 total, u32 top)
+{
+    std::vector<entry> entries;
+    for (std::map<std::string, u32>::iterator it = counts.begin(); it != counts.end(); ++it)
+    {
+        entry e;
+        e.name = it->first;
+        e.count = it->second;
+        entries.push_back(e);
+    }
+    std::stable_sort(entries.begin(), entries.end());
+
+    printf("\n%s\n  samples       %%  cumul%%  name\n", title);
+    u32 cumulated = 0;
+    for (size_t i = 0; i < entries.size() && i < top; ++i)
+    {
+        cumulated += entries[i].count;
+        printf("%9u  %6.2f  %6.2f  %s\n", entries[i].count, 100.0 * entries[i].count / total, 100.0 * cumulated / total, entries[i].name.c_str());
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    if (argc < 3)
+    {
+        fprintf(stderr, "usage : %s capture.bin firmware.elf [top_count]\n", argv[0]);
+        return 1;
+    }
+    u32 top = (argc > 3) ? atoi(argv[3]) : 40;
+
+    std::vector<symbol> symbols;
+    if (!load_symbols(argv[2], symbols))
+    {
+        fprintf(stderr, "could not read the symbols of %s\n", argv[2]);
+        return 1;
+    }
+
+    FILE* file = fopen(argv[1], "rb");
+    if (!file)
+    {
+        fprintf(stderr, "could not open %s\n", argv[1]);
+        return 1;
+    }
+    std::vector<u8> data;
+    u8 buffer[4096];
+    size_t read_count;
+    while ((read_count = fread(buffer, 1, sizeof(buffer), file)) > 0)
+        data.insert(data.end(), buffer, buffer + read_count);
+    fclose(file);
+
+    std::map<u8, std::string> task_names;
+    std::map<std::string, u32> functions;
+    std::map<std::string, u32> tasks;
+    u32 total = 0, dropped = 0, skipped = 0, rate = 0;
+
+    // the capture may start in the middle of a record : resynchronize on anything that does not parse
+    size_t pos = 0;
+    while (pos < data.size())
+    {
+        size_t left = data.size() - pos;
+        u8 type = data[pos];
+        if (type == record::sample && left >= 6)
+        {
+            u32 pc = read_u32(data, pos + 1);
+            u8 index = data[pos + 5];
+            ++functions[lookup(symbols, pc)];
+            std::map<u8, std::string>::iterator it = task_names.find(index);
+            ++tasks[(it != task_names.end()) ? it->second : (index == 0xFF ? "<no task>" : "<undeclared task>")];
+            ++total;
+            pos += 6;
+        }
+        else if (type == record::task && left >= 3 && left >= 3u + data[pos + 2])
+        {
+            task_names[data[pos + 1]] = std::string(reinterpret_cast<const char*>(&data[pos + 3]), data[pos + 2]);
+            pos += 3 + data[pos + 2];
+        }
+        else if (type == record::overflow && left >= 3)
+        {
+            dropped += data[pos + 1] | (data[pos + 2] << 8);
+            pos += 3;
+        }
+        else if (type == record::start && left >= 5)
+        {
+            rate = read_u32(data, pos + 1);
+            task_names.clear(); // the target declares its tasks again after each start
+            pos += 5;
+        }
+        else
+        {
+            ++skipped;
+            ++pos;
+        }
+    }
+
+    if (!total)
+    {
+        fprintf(stderr, "no samples in %s\n", argv[1]);
+        return 1;
+    }
+
+    printf("%u samples", total);
+    if (rate)
+        printf(" at %u Hz (%.1f s)", rate, static_cast<double>(total) / rate);
+    printf(", %u dropped, %u bytes skipped\n", dropped, skipped);
+
+    print_table("by function", functions, total, top);
+    print_table("by task", tasks, total, top);
+    return 0;
+}
\ No newline at end of file
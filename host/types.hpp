@@ -0,0 +1,9 @@
+#pragma once
+
+// the u8..u64 types of armtastic/types.hpp, for the host tools that include target headers pulling "types.hpp" in.
+// build those from this directory with -I.
+
+typedef unsigned char u8;
+typedef unsigned short u16;
+typedef unsigned int u32;
+typedef unsigned long long u64;
\ No newline at end of file
@@ -0,0 +1,16 @@
+#include "interrupt_lpc3230.hpp"
+
+namespace lpc3230
+{
+
+namespace interrupt
+{
+    controller::vector_entry controller::vectors[NUMINTERRUPTS];
+
+    #if ENABLE_ISR_PROFILING
+        callback controller::plain_routines[NUMINTERRUPTS];
+        isr_statistics controller::isr_stats[NUMINTERRUPTS];
+    #endif
+}
+
+}
\ No newline at end of file
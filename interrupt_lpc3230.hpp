@@ -4,8 +4,9 @@
 #include "armtastic/ring_buffer.hpp"
 #include <ctl_api.h>
 #include <libarm.h>
+#include <string.h>
 #include "targets/LPC3200.h"
-#include "modules/init/globals.hpp"
+#include "registers_lpc3230.hpp"
 
 namespace lpc3230
 {
@@ -60,22 +61,86 @@ namespace interrupt
     }
 
     typedef void (*callback)(void);
+    typedef void (*context_callback)(void* context);
+    typedef void (*deferred_callback)(void* context, u32 payload);
+
+    // compile-time thunk : lets a driver register one of its member functions along with its own instance as context,
+    // so several instances of the same driver are served without going through a global accessor
+    template <typename T, void (T::*Method)()>
+    void member_thunk(void* context)
+    {
+        (static_cast<T*>(context)->*Method)();
+    }
+
+    // deferred calls of a higher priority are always drained before the lower ones, but never preempt a deferred call already running
+    namespace deferred_priority
+    {
+        enum en
+        {
+            high = 0,
+            normal,
+            low,
+            count,
+        };
+    }
+
+    struct deferred_call
+    {
+        deferred_callback routine;
+        void* context;
+        u32 payload;
+    };
+
+    #if ENABLE_ISR_PROFILING
+        // durations are in high speed timer ticks (periph_clock, 13 MHz). bucket n of the histogram counts the durations below (16 << n) ticks, the last one counts all the longer ones.
+        static const u8 isr_histogram_buckets = 8;
+
+        struct isr_statistics
+        {
+            u32 count;
+            u64 total_ticks;
+            u32 max_ticks;
+            u32 histogram[isr_histogram_buckets];
+        };
+    #endif
+
+    template <u32 I> struct vector_tag {};
 
     class controller
     {
     public:
         void init()
         {
+            software_ids_pending = false;
+            deferred_overflows = 0;
+            for (u8 p = 0; p < deferred_priority::count; ++p)
+            {
+                deferred_queues[p].read = 0;
+                deferred_queues[p].write = 0;
+            }
+
             libarm_enable_irq_fiq();
-            install_service_routine(id::software, NUMINTERRUPTS - 1, false, trigger::high_level, static_isr); // install software interrupts on lowest priority
+            install_service_routine(id::software, NUMINTERRUPTS - 1, false, trigger::high_level, member_thunk<controller, &controller::isr>, this); // install software interrupts on lowest priority
             enable_interrupt(id::software);
         }
 
         void install_service_routine(id::en i, u8 priority, bool fast, trigger::en t, callback routine)
         {
-            priority %= NUMINTERRUPTS;
-            if (fast) priority += NUMINTERRUPTS;
-            ctl_set_isr(i, priority, (CTL_ISR_TRIGGER_t)t, routine, 0);
+            #if ENABLE_ISR_PROFILING
+                // go through the per-vector thunk, which timestamps the routine
+                plain_routines[i] = routine;
+                install_service_routine(i, priority, fast, t, call_plain_routine, &plain_routines[i]);
+            #else
+                set_isr(i, priority, fast, t, routine);
+            #endif
+        }
+
+        // the routine is called with the given context from a per-vector thunk, no lookup is needed to find the driver instance
+        void install_service_routine(id::en i, u8 priority, bool fast, trigger::en t, context_callback routine, void* context)
+        {
+            vectors[i].routine = routine;
+            vectors[i].context = context;
+            set_isr(i, priority, fast, t, vector_isr_for(i, vector_tag<NUMINTERRUPTS - 1>()));
         }
 
         void install_software_service_routine(u8 id, callback routine)
@@ -97,36 +162,182 @@ namespace interrupt
         void enqueue_software_interrupt(u8 id)
         {
             interrupt_queue.fast_write(id);
+            software_ids_pending = true;
             SW_INT = 1;
         }
 
+        // queue a call to be run from the software interrupt, out of the caller's interrupt context. safe to call from tasks and IRQ handlers (not from FIQ).
+        // returns false if the queue for that priority is full, in which case the call is dropped and counted in the overflow statistic.
+        bool enqueue_deferred_call(deferred_priority::en priority, deferred_callback routine, void* context, u32 payload = 0)
+        {
+            deferred_queue& queue = deferred_queues[priority];
+            bool queued = false;
+
+            int enabled = ctl_global_interrupts_disable(); // producers may be tasks or IRQ handlers of any priority
+            u8 next = (queue.write + 1) & (deferred_queue_size - 1);
+            if (next != queue.read)
+            {
+                deferred_call& call = queue.calls[queue.write];
+                call.routine = routine;
+                call.context = context;
+                call.payload = payload;
+                queue.write = next;
+                queued = true;
+            }
+            else
+                ++deferred_overflows;
+            ctl_global_interrupts_set(enabled);
+
+            if (queued)
+                SW_INT = 1;
+            return queued;
+        }
+
+        u32 get_deferred_overflows() { return deferred_overflows; }
+
+        #if ENABLE_ISR_PROFILING
+            static const isr_statistics& get_isr_stats(id::en i)
+            {
+                return isr_stats[i];
+            }
+
+            static void clear_isr_stats()
+            {
+                memset(isr_stats, 0, sizeof(isr_stats));
+            }
+        #endif
+
     private:
-        static void static_isr()
+        struct vector_entry
+        {
+            context_callback routine;
+            void* context;
+        };
+
+        static void set_isr(id::en i, u8 priority, bool fast, trigger::en t, callback routine)
         {
-            get_int_ctrl().isr();
+            priority %= NUMINTERRUPTS;
+            if (fast) priority += NUMINTERRUPTS;
+            ctl_set_isr(i, priority, (CTL_ISR_TRIGGER_t)t, routine, 0);
+        }
+
+        template <u32 I>
+        static void vector_isr()
+        {
+            #if ENABLE_ISR_PROFILING
+                u32 entry = high_speed_timer::regs.counter;
+                vectors[I].routine(vectors[I].context);
+                record_duration(I, high_speed_timer::regs.counter - entry); // modulo arithmetic handles the counter wrap
+            #else
+                vectors[I].routine(vectors[I].context);
+            #endif
+        }
+
+        // compile-time unrolled search, so each vector gets its own thunk without a table to initialize
+        template <u32 I>
+        static callback vector_isr_for(u32 i, vector_tag<I>)
+        {
+            return (i == I) ? vector_isr<I> : vector_isr_for(i, vector_tag<I - 1>());
+        }
+        static callback vector_isr_for(u32 i, vector_tag<0>)
+        {
+            return vector_isr<0>;
         }
 
         void isr()
         {
-            bool more;
-            u8 id;
+            // clear the interrupt first : anything queued while we drain raises it again, instead of being lost until the next request
+            SW_INT = 0;
 
-            do
+            if (software_ids_pending)
             {
-                // clear the interrupt and retrieve next id
-                more = interrupt_queue.fast_read(id);
+                bool more;
+                u8 id;
 
-                if (id < callback_table_size && software_callbacks[id])
-                    software_callbacks[id]();
-            } while (more);
+                software_ids_pending = false;
+                do
+                {
+                    // retrieve next id. the flag may be raised for an id a previous run already drained : the read then leaves id alone
+                    id = no_software_id;
+                    more = interrupt_queue.fast_read(id);
+                    if (id == no_software_id)
+                        break;
 
-            SW_INT = 0;
+                    if (id < callback_table_size && software_callbacks[id])
+                        software_callbacks[id]();
+                } while (more);
+            }
+
+            deferred_call call;
+            while (dequeue_deferred_call(call))
+                call.routine(call.context, call.payload);
         }
 
+        // single consumer : only the software interrupt moves the read index, so no locking is needed here
+        bool dequeue_deferred_call(deferred_call& call)
+        {
+            for (u8 p = 0; p < deferred_priority::count; ++p)
+            {
+                deferred_queue& queue = deferred_queues[p];
+                if (queue.read != queue.write)
+                {
+                    call = queue.calls[queue.read];
+                    queue.read = (queue.read + 1) & (deferred_queue_size - 1);
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        #if ENABLE_ISR_PROFILING
+            static void call_plain_routine(void* context)
+            {
+                (*static_cast<callback*>(context))();
+            }
+
+            static void record_duration(u32 i, u32 duration)
+            {
+                isr_statistics& stats = isr_stats[i];
+                ++stats.count;
+                stats.total_ticks += duration;
+                if (duration > stats.max_ticks)
+                    stats.max_ticks = duration;
+
+                u8 bucket = 0;
+                u32 limit = 16;
+                while (bucket < isr_histogram_buckets - 1 && duration >= limit)
+                {
+                    ++bucket;
+                    limit <<= 1;
+                }
+                ++stats.histogram[bucket];
+            }
+        #endif
+
         static const u8 callback_table_size = 8;
+        static const u8 no_software_id = 0xFF; // outside the callback table, an id nobody can serve
+        static const u8 deferred_queue_size = 32; // must be a power of 2
+
+        struct deferred_queue
+        {
+            deferred_call calls[deferred_queue_size];
+            volatile u8 read;
+            volatile u8 write;
+        };
 
         ring_buffer<u8, 32, volatile u8*> interrupt_queue;
         callback software_callbacks[callback_table_size];
+        volatile bool software_ids_pending;
+
+        deferred_queue deferred_queues[deferred_priority::count];
+        u32 deferred_overflows;
+
+        static vector_entry vectors[NUMINTERRUPTS];
+
+        #if ENABLE_ISR_PROFILING
+            static callback plain_routines[NUMINTERRUPTS];
+            static isr_statistics isr_stats[NUMINTERRUPTS];
+        #endif
     };
 }
 
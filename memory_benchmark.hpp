@@ -0,0 +1,343 @@
+#pragma once
+
+// memory subsystem benchmark, independent of the hardware : the platform policy supplies the timer, the cache maintenance, the copy kernels
+// and the DMA. memory_benchmark_lpc3230.hpp is the board policy, host/memory_benchmark.cpp runs the same harness against a model of it.
+// needs the u8..u64 types of armtastic/types.hpp (the host tools declare their own) before inclusion.
+
+#include "uart_client.hpp"
+
+namespace lpc3230
+{
+
+namespace benchmark
+{
+    // what a platform policy provides :
+    //   u32 tick_frequency();                                 rate of ticks(), in Hz
+    //   u32 ticks();                                          free-running counter, wraps
+    //   void sync(u32* start, u32* end);                      write back and drop the range from the caches : every test starts cold
+    //   void read(const u32* start, const u32* end);          streaming kernels, the range is a multiple of 32 bytes
+    //   void write(u32* start, u32* end);
+    //   void copy(const u32* source, u32* dest, u32 words);
+    //   bool dma_copy(const u32* source, u32* dest, u32 words);  blocks until done, false on a bus error
+    // and for run_arbitration only :
+    //   u8 arbitration_profile_count();                       the ways the memory controller can share the memory between the CPU and the DMA
+    //   const char* arbitration_profile_name(u8 profile);
+    //   u8 get_arbitration_profile();
+    //   void set_arbitration_profile(u8 profile);
+    //   u32 dma_max_words();
+    //   void dma_start(const u32* source, u32* dest, u32 words);  at most dma_max_words, returns at once
+    //   bool dma_busy();
+    //   bool dma_failed();
+
+    struct region
+    {
+        const char* name;
+        u32* base;
+        u32 bytes; // split in two halves : source and destination
+        bool dma_reachable;
+    };
+
+    namespace test
+    {
+        enum en
+        {
+            read,
+            write,
+            copy,
+            latency,
+            dma_copy,
+            cpu_copy, // same transfer as dma_copy, timed the same way, for the comparison
+            contended_dma, // dma_copy while the CPU runs the latency test, per arbitration profile
+            contended_latency, // the latency test while the DMA copies
+            count,
+        };
+    }
+
+    struct result
+    {
+        const region* where;
+        const char* variant; // arbitration profile of the contended tests, 0 otherwise
+        test::en what;
+        u32 value; // tenths of MB/s, or tenths of ns for latency. 0 when the test failed
+    };
+
+    template <typename Platform>
+    class suite : public uart_client
+    {
+    public:
+        suite(Platform& p) : platform(p), result_count(0), sent(0), send_header(false), line_length(0), line_pos(0), sink(0) {}
+
+        void run(const region* regions, u8 region_count)
+        {
+            result_count = 0;
+            sent = 0;
+            line_length = 0;
+            line_pos = 0;
+            send_header = true;
+
+            for (u8 r = 0; r < region_count && result_count + test::count <= max_results; ++r)
+            {
+                const region& where = regions[r];
+                u32 words = (where.bytes / 8) & ~0x7; // half the region, in whole cache lines
+                u32* source = where.base;
+                u32* dest = where.base + words;
+
+                platform.sync(source, dest + words);
+                u32 start = platform.ticks();
+                platform.read(source, source + words);
+                add(where, test::read, bandwidth(words * 4, platform.ticks() - start));
+
+                platform.sync(source, dest + words);
+                start = platform.ticks();
+                platform.write(source, source + words);
+                add(where, test::write, bandwidth(words * 4, platform.ticks() - start));
+
+                platform.sync(source, dest + words);
+                start = platform.ticks();
+                platform.copy(source, dest, words);
+                add(where, test::copy, bandwidth(words * 4, platform.ticks() - start));
+
+                add(where, test::latency, latency(source, words));
+
+                if (where.dma_reachable)
+                {
+                    platform.sync(source, dest + words);
+                    start = platform.ticks();
+                    bool ok = platform.dma_copy(source, dest, words);
+                    add(where, test::dma_copy, ok ? bandwidth(words * 4, platform.ticks() - start) : 0);
+
+                    // the DMA leaves the data in memory only : flush the copy's view too, then time the CPU on the same cold transfer
+                    platform.sync(source, dest + words);
+                    start = platform.ticks();
+                    platform.copy(source, dest, words);
+                    add(where, test::cpu_copy, bandwidth(words * 4, platform.ticks() - start));
+                }
+            }
+        }
+
+        // the DMA streams through one region while the CPU chases pointers in the other, once per arbitration profile :
+        // shows what each profile gives the DMA and costs the CPU. the profile in effect before is restored. adds to the results of run.
+        void run_arbitration(const region& dma_area, const region& chase_area)
+        {
+            u8 previous = platform.get_arbitration_profile();
+            for (u8 p = 0; p < platform.arbitration_profile_count() && result_count + 2 <= max_results; ++p)
+            {
+                const char* name = platform.arbitration_profile_name(p);
+                platform.set_arbitration_profile(p);
+
+                u32 words = (dma_area.bytes / 8) & ~0x7;
+                const u32* source = dma_area.base;
+                u32* dest = dma_area.base + words;
+                u32* chain = chase_area.base;
+                if (!build_chain(chain, (chase_area.bytes / 4) & ~0x7))
+                    break;
+                platform.sync(dma_area.base, dest + words);
+
+                u32 remaining = words;
+                u32 chunk = (remaining > platform.dma_max_words()) ? platform.dma_max_words() : remaining;
+                u32 link = 0;
+                u32 steps = 0;
+                bool ok = true;
+
+                u32 start = platform.ticks();
+                platform.dma_start(source, dest, chunk);
+                for (;;)
+                {
+                    for (u32 i = contended_steps; i; --i)
+                        link = chain[link];
+                    steps += contended_steps;
+
+                    if (platform.dma_busy())
+                        continue;
+                    if (platform.dma_failed())
+                    {
+                        ok = false;
+                        break;
+                    }
+                    source += chunk;
+                    dest += chunk;
+                    remaining -= chunk;
+                    if (!remaining)
+                        break;
+                    chunk = (remaining > platform.dma_max_words()) ? platform.dma_max_words() : remaining;
+                    platform.dma_start(source, dest, chunk);
+                }
+                u32 ticks = platform.ticks() - start;
+                sink += link;
+
+                add(dma_area, test::contended_dma, ok ? bandwidth(words * 4, ticks) : 0, name);
+                add(chase_area, test::contended_latency, ok ? nanosec(ticks, steps) : 0, name);
+            }
+            platform.set_arbitration_profile(previous);
+        }
+
+        u8 get_result_count() { return result_count; }
+        const result& get_result(u8 index) { return results[index]; }
+
+        // streams the results as text lines
+        template <typename Uart>
+        void report(Uart& uart)
+        {
+            uart.set_client(*this);
+            uart.trigger_transmit();
+        }
+
+        virtual bool get_byte(u8* byte)
+        {
+            if (line_pos >= line_length && !next_line())
+                return false;
+            if (!byte)
+                return true;
+            *byte = line[line_pos++];
+            return line_pos < line_length || next_line();
+        }
+
+        virtual bool set_byte(u8* byte) { return true; } // nothing to receive, drop it
+        virtual void receive_event() {}
+        virtual void error_event(u8 error) {}
+
+    private:
+        // tenths of MB/s
+        u32 bandwidth(u32 bytes, u32 ticks)
+        {
+            if (!ticks)
+                ticks = 1;
+            return static_cast<u32>(static_cast<u64>(bytes) * platform.tick_frequency() / 100000 / ticks);
+        }
+
+        // tenths of ns per step
+        u32 nanosec(u32 ticks, u32 steps)
+        {
+            return static_cast<u32>(static_cast<u64>(ticks) * 10000000000ULL / platform.tick_frequency() / steps);
+        }
+
+        // links one word per cache line into a cycle in pseudo random order, so neither the cache nor the burst of the previous load helps
+        // the next one. the links are word indexes rather than pointers so the host model runs with 64-bit pointers. returns the line count.
+        u32 build_chain(u32* area, u32 words)
+        {
+            u32 lines = 1;
+            while (lines * 2 <= words / 8)
+                lines *= 2;
+            if (lines < 2)
+                return 0;
+
+            // full period lcg over a power of two : every line is visited once per round
+            u32 index = 0;
+            for (u32 i = 0; i < lines; ++i)
+            {
+                u32 next = (index * lcg_multiplier + lcg_increment) & (lines - 1);
+                area[index * 8] = next * 8;
+                index = next;
+            }
+            platform.sync(area, area + lines * 8);
+            return lines;
+        }
+
+        u32 latency(u32* area, u32 words)
+        {
+            u32 lines = build_chain(area, words);
+            if (!lines)
+                return 0;
+
+            u32 steps = (lines < latency_steps) ? lines : latency_steps;
+            u32 link = 0;
+            u32 start = platform.ticks();
+            for (u32 i = steps; i; --i)
+                link = area[link];
+            u32 ticks = platform.ticks() - start;
+            sink += link; // keeps the chase alive
+
+            return nanosec(ticks, steps);
+        }
+
+        void add(const region& where, test::en what, u32 value, const char* variant = 0)
+        {
+            result& r = results[result_count++];
+            r.where = &where;
+            r.variant = variant;
+            r.what = what;
+            r.value = value;
+        }
+
+        // formats the next line, called from the uart interrupt
+        bool next_line()
+        {
+            line_pos = 0;
+            line_length = 0;
+
+            if (send_header)
+            {
+                send_header = false;
+                put_string("memory benchmark, timer at ");
+                put_decimal(platform.tick_frequency(), false);
+                put_string(" Hz\r\n");
+                return true;
+            }
+
+            if (sent >= result_count)
+                return false;
+
+            const result& r = results[sent++];
+            static const char* const names[test::count] = { "read", "write", "copy", "latency", "dma_copy", "cpu_copy", "contended_dma", "contended_latency" };
+            put_string(r.where->name);
+            put_string(" ");
+            if (r.variant)
+            {
+                put_string(r.variant);
+                put_string(" ");
+            }
+            put_string(names[r.what]);
+            put_string(" ");
+            if (r.value)
+                put_decimal(r.value, true);
+            else
+                put_string("failed");
+            put_string((test::latency == r.what || test::contended_latency == r.what) ? " ns\r\n" : " MB/s\r\n");
+            return true;
+        }
+
+        void put_string(const char* s)
+        {
+            while (*s && line_length < max_line_length)
+                line[line_length++] = *s++;
+        }
+
+        void put_decimal(u32 value, bool tenths)
+        {
+            char digits[10];
+            u8 count = 0;
+            u32 whole = tenths ? value / 10 : value;
+            do
+            {
+                digits[count++] = '0' + whole % 10;
+                whole /= 10;
+            } while (whole);
+            while (count && line_length < max_line_length)
+                line[line_length++] = digits[--count];
+            if (tenths && line_length + 2 <= max_line_length)
+            {
+                line[line_length++] = '.';
+                line[line_length++] = '0' + value % 10;
+            }
+        }
+
+        static const u8 max_results = 48;
+        static const u8 max_line_length = 64;
+        static const u32 latency_steps = 4096;
+        static const u32 contended_steps = 64; // chase steps between two looks at the DMA
+        static const u32 lcg_multiplier = 0x41C64E6D; // multiplier = 1 mod 4 and odd increment : full period modulo any power of two
+        static const u32 lcg_increment = 12345;
+
+        Platform& platform;
+        result results[max_results];
+        u8 result_count;
+        volatile u8 sent;
+        bool send_header;
+        char line[max_line_length];
+        u8 line_length;
+        u8 line_pos;
+        u32 sink;
+    };
+}
+
+}
\ No newline at end of file
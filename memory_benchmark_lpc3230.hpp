@@ -0,0 +1,117 @@
+#pragma once
+
+#include "armtastic/types.hpp"
+#include "memory_benchmark.hpp"
+#include "timer_lpc3230.hpp"
+#include "dma_lpc3230.hpp"
+#include "cp15_arm926ejs.hpp"
+#include "clock_lpc3230.hpp"
+#include "emc_lpc3230.hpp"
+#include "modules/init/globals.hpp"
+
+namespace lpc3230
+{
+
+namespace benchmark
+{
+    // the three kinds of memory a buffer can live in. the DDR halves are larger than the 32 kB data cache, so the cached figures are not
+    // those of the cache itself. include this file in the benchmark target only : it reserves the buffers.
+    static const u32 iram_benchmark_bytes = 32 * 1024;
+    static const u32 ddr_benchmark_bytes = 512 * 1024;
+    static u32 iram_benchmark_buffer[iram_benchmark_bytes / 4] __attribute__ ((section (".iram_bss_no_cache"), aligned (32)));
+    static u32 ddr_benchmark_buffer[ddr_benchmark_bytes / 4] __attribute__ ((aligned (32)));
+    static u32 ddr_no_cache_benchmark_buffer[ddr_benchmark_bytes / 4] __attribute__ ((section (".ddr_bss_no_cache"), aligned (32)));
+
+    static const region board_regions[] =
+    {
+        { "iram", iram_benchmark_buffer, iram_benchmark_bytes, true },
+        { "ddr_cached", ddr_benchmark_buffer, ddr_benchmark_bytes, true },
+        { "ddr_uncached", ddr_no_cache_benchmark_buffer, ddr_benchmark_bytes, true },
+    };
+    static const u8 board_region_count = sizeof(board_regions) / sizeof(board_regions[0]);
+
+    // board policy of the benchmark suite. takes timer 0 and DMA channel 7 over while it lives.
+    // the kernels move 8 registers per LDM/STM, which the EMC turns into 8-beat bursts : what the DMA and a cache line fill do.
+    class board
+    {
+    public:
+        board() { standard_timer::timer_0_start_count(); }
+        ~board() { standard_timer::timer_0_stop_count(); }
+
+        u32 tick_frequency() { return get_hw_clock().get_periph_freq(); }
+        u32 ticks() { return standard_timer::timer_0_get_count(); }
+
+        void sync(u32* start, u32* end)
+        {
+            if (cp15_data_cache_enabled())
+                cp15_clean_invalidate_data_cache_range(start, end);
+        }
+
+        void read(const u32* start, const u32* end)
+        {
+            __asm__ volatile("1:\n\t"
+                             "LDMIA %0!, {r3-r10}\n\t"
+                             "CMP %0, %1\n\t"
+                             "BLO 1b"
+                             : "+r"(start) : "r"(end) : "r3", "r4", "r5", "r6", "r7", "r8", "r9", "r10", "cc", "memory");
+        }
+
+        void write(u32* start, u32* end)
+        {
+            __asm__ volatile("MOV r3, #0\n\t"
+                             "MOV r4, r3\n\t"
+                             "MOV r5, r3\n\t"
+                             "MOV r6, r3\n\t"
+                             "MOV r7, r3\n\t"
+                             "MOV r8, r3\n\t"
+                             "MOV r9, r3\n\t"
+                             "MOV r10, r3\n"
+                             "1:\n\t"
+                             "STMIA %0!, {r3-r10}\n\t"
+                             "CMP %0, %1\n\t"
+                             "BLO 1b"
+                             : "+r"(start) : "r"(end) : "r3", "r4", "r5", "r6", "r7", "r8", "r9", "r10", "cc", "memory");
+        }
+
+        void copy(const u32* source, u32* dest, u32 words)
+        {
+            const u32* end = source + words;
+            __asm__ volatile("1:\n\t"
+                             "LDMIA %0!, {r3-r10}\n\t"
+                             "STMIA %1!, {r3-r10}\n\t"
+                             "CMP %0, %2\n\t"
+                             "BLO 1b"
+                             : "+r"(source), "+r"(dest) : "r"(end) : "r3", "r4", "r5", "r6", "r7", "r8", "r9", "r10", "cc", "memory");
+        }
+
+        bool dma_copy(const u32* source, u32* dest, u32 words)
+        {
+            return dma::controller::copy_polled<dma_channel>(source, dest, words);
+        }
+
+        u8 arbitration_profile_count() { return emc::ahb_profile::count; }
+        const char* arbitration_profile_name(u8 profile) { return emc::get_ahb_profile_name(static_cast<emc::ahb_profile::en>(profile)); }
+        u8 get_arbitration_profile() { return emc::get_ahb_profile(); }
+        void set_arbitration_profile(u8 profile) { emc::set_ahb_profile(static_cast<emc::ahb_profile::en>(profile)); }
+
+        u32 dma_max_words() { return dma::controller::max_copy_words; }
+        void dma_start(const u32* source, u32* dest, u32 words) { dma::controller::start_copy<dma_channel>(source, dest, words); }
+        bool dma_busy() { return dma::controller::copy_busy<dma_channel>(); }
+        bool dma_failed() { return dma::controller::copy_failed<dma_channel>(); }
+
+    private:
+        static const u8 dma_channel = 7;
+    };
+
+    // runs the whole suite and streams the results over the given uart. the suite must outlive the transmission.
+    // the arbitration test streams the DMA through uncached DDR while the CPU misses in cached DDR : both compete for the EMC.
+    template <typename Uart>
+    void run_board_benchmark(suite<board>& s, Uart& uart)
+    {
+        s.run(board_regions, board_region_count);
+        s.run_arbitration(board_regions[2], board_regions[1]);
+        s.report(uart);
+    }
+}
+
+}
\ No newline at end of file
@@ -1,4 +1,6 @@
 #include "mmu_arm926ejs.hpp"
+#include "page_table_builder_arm926ejs.hpp"
+#include "cp15_arm926ejs.hpp"
 #include "modules/debug/assert.h"
 
 using namespace arm926ejs;
@@ -19,153 +21,86 @@ extern "C" void enable_cache(u32* table, u32* start, u32 size)
         table[m] |= 0x8;
 }
 
-extern "C" void install_page_tables(u32* table, const first_level_instruction* first_level_inst, u32 first_level_size, const second_level_instruction* second_level_inst, u32 second_level_size)
+namespace
 {
-    // a page table is not required for the software to run. however, by programming the MMU to use one, we can set access restrictions on certain address ranges
-    // without using any address translation (1-to-1 mapping between the virtual and physical addresses)
-    // this is the only way of protecting the low address space (containing the exception vectors, at address 0 and up) from overwriting.
-    // since null-pointer dereference bugs are common, protecting address 0 from write-access protects our abort handlers so they can report the problem.
-    u32* secondary_table = table + 4096;
-    
-    //#ifdef DEBUG
-    //    u32 hole_detector = 0xffffffff;
-    //#endif
-
     // all assert used here cannot log, and cannot debug_break using JTAG, we're in the .reset section, this stuff is not available
     // thus, we use an assert macro which generates a data abort. dangerous, but will help detect equally dangerous problems.
-    assert_abort(table);
-    assert_abort(first_level_inst);
-    assert_abort(first_level_size);
-    //assert_abort(first_level_inst[0].start_addr == 0);
-    //assert_abort(first_level_inst[first_level_size - 1].end_addr == 0xffffffff);
-    
-    for (u32 i = 0; i < first_level_size; ++i)
+    // holes, overlaps and the placement of the second level tables are only reported by host/page_table_check, as before.
+    struct abort_on_error
     {
-        assert_abort((first_level_inst[i].start_addr & 0xfffff) == 0); // aligned on megabytes
-        assert_abort((first_level_inst[i].end_addr & 0xfffff) == 0xfffff); // aligned on megabytes, minus 1
-        assert_abort(first_level_inst[i].start_addr < first_level_inst[i].end_addr);
-
-        #ifdef DEBUG
-            //assert_abort(hole_detector == first_level_inst[i].start_addr - 1);
-            //hole_detector = first_level_inst[i].end_addr;
-        #endif
-
-        for (u32 m = first_level_inst[i].start_addr; m < first_level_inst[i].end_addr; m += 0x100000)
+        void operator()(page_table_error::en error, u32)
         {
-            switch (first_level_inst[i].type)
+            switch (error)
             {
-            case first_level_descriptor_type::fault:
-                table[m >> 20] = 0x00;
+            case page_table_error::misaligned_table:
+            case page_table_error::hole:
+            case page_table_error::overlap:
+            case page_table_error::misaligned_second_level_table:
+            case page_table_error::second_level_overflow:
                 break;
-            case first_level_descriptor_type::coarse:
-                table[m >> 20] = 0x11 | (first_level_inst[i].domain_index << 5) | reinterpret_cast<u32>(secondary_table);
-                secondary_table += 256;
+            case page_table_error::misaligned_physical:
+                #ifdef DEBUG
+                    assert_abort(false);
+                #endif
                 break;
-            case first_level_descriptor_type::section:
-                table[m >> 20] = 0x12 |
-                                 (first_level_inst[i].bufferable ? 0x4 : 0) |
-                                 (first_level_inst[i].cacheable ? 0x8 : 0) |
-                                 (first_level_inst[i].domain_index << 5) |
-                                 (first_level_inst[i].access << 10) |
-                                 (first_level_inst[i].physical_page_addr + (m - first_level_inst[i].start_addr));
-                break;
-            case first_level_descriptor_type::fine:
-                table[m >> 20] = 0x13 | (first_level_inst[i].domain_index << 5) | reinterpret_cast<u32>(secondary_table);
-                secondary_table += 1024;
+            default:
+                assert_abort(false);
                 break;
             }
         }
-    }
-
-    assert_abort( (0 == second_level_size) || (0 != second_level_inst) );
-
-    secondary_table = table + 4096;
+    };
+}
 
-    for (u32 i = 0; i < second_level_size; ++i)
-    {
-        u8 type_bits = table[second_level_inst[i].start_addr >> 20] & 0x3;
-        assert_abort((type_bits & 0x1) == 1); // make sure it was declared as a coarse or fine table
-        first_level_descriptor_type::en type = (type_bits == 0x1) ? first_level_descriptor_type::coarse : first_level_descriptor_type::fine;
-        //#ifdef DEBUG
-        //    hole_detector = second_level_inst[i].start_addr - 1;
-        //#endif
+extern "C" void install_page_tables(u32* table, const first_level_instruction* first_level_inst, u32 first_level_size, const second_level_instruction* second_level_inst, u32 second_level_size)
+{
+    // a page table is not required for the software to run. however, by programming the MMU to use one, we can set access restrictions on certain address ranges
+    // without using any address translation (1-to-1 mapping between the virtual and physical addresses)
+    // this is the only way of protecting the low address space (containing the exception vectors, at address 0 and up) from overwriting.
+    // since null-pointer dereference bugs are common, protecting address 0 from write-access protects our abort handlers so they can report the problem.
+    abort_on_error report;
+    build_page_tables(table, reinterpret_cast<u32>(table), first_level_inst, first_level_size, second_level_inst, second_level_size, report);
+}
 
-        // tiny pages not allowed for coarse table
-        assert_abort( !((type == first_level_descriptor_type::coarse) && (second_level_descriptor_size::tiny == second_level_inst[i].size)) );
+extern "C" void load_translation_table(const u32* table)
+{
+    u32 zero = 0;
+    __asm__ volatile("MCR p15, 0, %0, c7, c10, 4\n\t" // drain the write buffer, the table walks must see every store made so far
+                     "MCR p15, 0, %1, c2, c0, 0\n\t"  // translation table base
+                     "MCR p15, 0, %0, c8, c7, 0"      // invalidate the instruction and data TLBs
+                     : : "r"(zero), "r"(table) : "memory");
+}
 
-        u32 addr_mask;
-        if (second_level_descriptor_size::tiny == second_level_inst[i].size)       addr_mask = 0x3ff;
-        else if (second_level_descriptor_size::small == second_level_inst[i].size) addr_mask = 0xfff;
-        else if (second_level_descriptor_size::large == second_level_inst[i].size) addr_mask = 0xffff;
+extern "C" bool map_uncached_alias(u32* table, u32 alias_addr, u32 physical_addr, u32 size)
+{
+    if ((alias_addr & 0xfffff) || (physical_addr & 0xfffff) || !size)
+        return false;
 
-        assert_abort((second_level_inst[i].start_addr & addr_mask) == 0);
-        assert_abort((second_level_inst[i].end_addr   & addr_mask) == addr_mask);
-        assert_abort(second_level_inst[i].start_addr < second_level_inst[i].end_addr);
+    u32 first = alias_addr >> 20;
+    u32 last = (alias_addr + size - 1) >> 20;
+    if (last < first) // the alias wraps around
+        return false;
 
-        #ifdef DEBUG
-            //assert_abort(hole_detector == second_level_inst[i].start_addr - 1);
-            //hole_detector = second_level_inst[i].end_addr;
-            if (second_level_descriptor_size::large == second_level_inst[i].size)
-            {
-                assert_abort((second_level_inst[i].physical_page_addr & 0xffff) == 0);
-            }
-            else if (second_level_descriptor_size::small == second_level_inst[i].size)
-            {
-                assert_abort((second_level_inst[i].physical_page_addr & 0xfff) == 0);
-            }
-            else if (second_level_descriptor_size::tiny == second_level_inst[i].size)
-            {
-                assert_abort((second_level_inst[i].physical_page_addr & 0x3ff) == 0);
-            }
-        #endif
+    // bufferable section, domain 0
+    const u32 descriptor = 0x12 | 0x4 | (access_permission::priv_rw_user_rw << 10);
 
-        u32 value = 0;
-        switch (second_level_inst[i].size)
-        {
-        case second_level_descriptor_size::fault:
-            value = 0x0;
-            break;
-        case second_level_descriptor_size::large:
-            value = 0x1 |
-                    (second_level_inst[i].bufferable ? 0x4 : 0) |
-                    (second_level_inst[i].cacheable ? 0x8 : 0) |
-                    (second_level_inst[i].access_0 << 4)  |
-                    (second_level_inst[i].access_1 << 6)  |
-                    (second_level_inst[i].access_2 << 8)  |
-                    (second_level_inst[i].access_3 << 10) |
-                    second_level_inst[i].physical_page_addr;
-            break;
-        case second_level_descriptor_size::small:
-            value = 0x2 |
-                    (second_level_inst[i].bufferable ? 0x4 : 0) |
-                    (second_level_inst[i].cacheable ? 0x8 : 0) |
-                    (second_level_inst[i].access_0 << 4)  |
-                    (second_level_inst[i].access_1 << 6)  |
-                    (second_level_inst[i].access_2 << 8)  |
-                    (second_level_inst[i].access_3 << 10) |
-                    second_level_inst[i].physical_page_addr;
-            break;
-        case second_level_descriptor_size::tiny:
-            value = 0x3 |
-                    (second_level_inst[i].bufferable ? 0x4 : 0) |
-                    (second_level_inst[i].cacheable ? 0x8 : 0) |
-                    (second_level_inst[i].access_0 << 4)  |
-                    second_level_inst[i].physical_page_addr;
-            break;
-        }
+    // checked before anything is written : only fault entries get replaced
+    bool mapped = true;
+    for (u32 m = first; m <= last; ++m)
+    {
+        u32 wanted = descriptor | (physical_addr + ((m - first) << 20));
+        if (table[m] != wanted)
+            mapped = false;
+        if (table[m] != wanted && (table[m] & 0x3) != 0)
+            return false;
+    }
+    if (mapped) // an uncached_alias_run of the layout already did it, the table may be read-only
+        return true;
 
-        u32 descriptor_span = 0;
-        if (type == first_level_descriptor_type::coarse) descriptor_span = 4096;
-        else                                             descriptor_span = 1024;
-        u32 physical_offset_accum = 0;
-        u32 loop_count = 0;
-        for (u32 m = second_level_inst[i].start_addr; m < second_level_inst[i].end_addr; m += descriptor_span, ++loop_count)
-        {
-            secondary_table[loop_count] = value + ((physical_offset_accum / descriptor_span) * descriptor_span);
-            physical_offset_accum += descriptor_span;
-        }
+    for (u32 m = first; m <= last; ++m)
+        table[m] = descriptor | (physical_addr + ((m - first) << 20));
 
-        //secondary_table += (type == first_level_descriptor_type::coarse) ? 256 : 1024;
-        secondary_table += loop_count;
-    }
+    // the table walks read memory, not the data cache
+    cp15_clean_data_cache_range(table + first, table + last + 1);
+    __asm__ volatile("MCR p15, 0, %0, c8, c7, 0" : : "r"(0) : "memory"); // invalidate the instruction and data TLBs
+    return true;
 }
\ No newline at end of file
@@ -77,5 +77,11 @@ struct second_level_instruction
 }
 
 extern "C" void initialize_flat_page_tables(u32* table) __attribute__ ((section (".init")));
+// points the MMU to a finished table (see page_table_arm926ejs.hpp) and drops the TLB entries of the previous one. the domain access and the enable bits are left alone.
+extern "C" void load_translation_table(const u32* table) __attribute__ ((section (".init")));
 extern "C" void enable_cache(u32* table, u32* start, u32 size) __attribute__ ((section (".init")));
-extern "C" void install_page_tables(u32* table, const arm926ejs::first_level_instruction* first_level_inst, u32 first_level_size, const arm926ejs::second_level_instruction* second_level_inst, u32 second_level_size);
\ No newline at end of file
+extern "C" void install_page_tables(u32* table, const arm926ejs::first_level_instruction* first_level_inst, u32 first_level_size, const arm926ejs::second_level_instruction* second_level_inst, u32 second_level_size);
+// maps size bytes of physical memory a second time at alias_addr, in sections that are bufferable but not cacheable : the CPU writes go
+// through the write buffer, reads always come from memory. works on the table the MMU is running on. both addresses on megabytes.
+// the alias megabytes must be fault entries, or already hold this very mapping : returns false otherwise, without touching the table.
+extern "C" bool map_uncached_alias(u32* table, u32 alias_addr, u32 physical_addr, u32 size);
\ No newline at end of file
@@ -0,0 +1,138 @@
+#pragma once
+
+#include "types.hpp"
+#include "mmu_arm926ejs.hpp"
+#include <boost/static_assert.hpp>
+
+// first level translation table built by the compiler : the layout is a list of section runs, every descriptor is computed and
+// every check install_page_tables makes at boot becomes a static assert. the 16 kB table lands in a read-only section, aligned
+// as the MMU wants it, and the boot code only loads its address in the TTB register.
+// sections only : layouts needing coarse or fine second level tables keep going through install_page_tables.
+//
+//   typedef arm926ejs::layout<arm926ejs::section_run<0x00000000, 0x7FFFFFFF, 0x00000000, false, false>,
+//           arm926ejs::layout<arm926ejs::section_run<0x80000000, 0x83FFFFFF, 0x80000000, true, true>,
+//           arm926ejs::layout<arm926ejs::section_run<0x84000000, 0xFFFFFFFF, 0x84000000, false, false> > > > board_layout;
+//   load_translation_table(arm926ejs::section_table<board_layout>::entries);
+
+namespace arm926ejs {
+
+// sections from start_addr to end_addr (inclusive, like first_level_instruction), mapped from physical_page_addr on
+template <u32 StartAddr, u32 EndAddr, u32 PhysicalAddr, bool Cacheable, bool Bufferable, access_permission::en Access = access_permission::priv_rw_user_rw, u8 DomainIndex = 0>
+struct section_run
+{
+    BOOST_STATIC_ASSERT((StartAddr & 0xfffff) == 0); // aligned on megabytes
+    BOOST_STATIC_ASSERT((EndAddr & 0xfffff) == 0xfffff); // aligned on megabytes, minus 1
+    BOOST_STATIC_ASSERT(StartAddr < EndAddr);
+    BOOST_STATIC_ASSERT((PhysicalAddr & 0xfffff) == 0);
+    BOOST_STATIC_ASSERT(PhysicalAddr <= 0xffffffff - (EndAddr - StartAddr)); // the physical range does not wrap around
+    BOOST_STATIC_ASSERT(DomainIndex < 16);
+
+    static const u32 first = StartAddr >> 20;
+    static const u32 last = EndAddr >> 20;
+
+    template <u32 Index>
+    struct descriptor
+    {
+        static const u32 value = 0x12 |
+                                 (Bufferable ? 0x4 : 0) |
+                                 (Cacheable ? 0x8 : 0) |
+                                 (DomainIndex << 5) |
+                                 (Access << 10) |
+                                 (PhysicalAddr + ((Index - first) << 20));
+    };
+};
+
+// sections any access to aborts
+template <u32 StartAddr, u32 EndAddr>
+struct fault_run
+{
+    BOOST_STATIC_ASSERT((StartAddr & 0xfffff) == 0); // aligned on megabytes
+    BOOST_STATIC_ASSERT((EndAddr & 0xfffff) == 0xfffff); // aligned on megabytes, minus 1
+    BOOST_STATIC_ASSERT(StartAddr < EndAddr);
+
+    static const u32 first = StartAddr >> 20;
+    static const u32 last = EndAddr >> 20;
+
+    template <u32 Index>
+    struct descriptor
+    {
+        static const u32 value = 0x00;
+    };
+};
+
+// a second view of Bytes of memory at AliasAddr, bufferable but not cacheable : for the DMA buffers, see map_uncached_alias
+template <u32 AliasAddr, u32 PhysicalAddr, u32 Bytes>
+struct uncached_alias_run : section_run<AliasAddr, AliasAddr + Bytes - 1, PhysicalAddr, false, true>
+{
+};
+
+struct end_of_layout {};
+
+// runs in increasing address order, covering the whole 4 GB without a hole or an overlap
+template <typename Run, typename Next = end_of_layout>
+struct layout
+{
+    typedef Run head;
+    typedef Next tail;
+};
+
+// the descriptor of the section at Index
+template <typename Layout, u32 Index>
+struct section_descriptor
+{
+    static const u32 value = (Index >= Layout::head::first && Index <= Layout::head::last) ?
+                             Layout::head::template descriptor<Index>::value :
+                             section_descriptor<typename Layout::tail, Index>::value;
+};
+
+template <u32 Index>
+struct section_descriptor<end_of_layout, Index>
+{
+    static const u32 value = 0x00;
+};
+
+// what the hole detector of install_page_tables checks, at compile time
+template <typename Layout, u32 NextIndex = 0>
+struct layout_check
+{
+    BOOST_STATIC_ASSERT(Layout::head::first == NextIndex); // no hole nor overlap with the previous run, and in increasing order
+    static const bool value = layout_check<typename Layout::tail, Layout::head::last + 1>::value;
+};
+
+template <u32 NextIndex>
+struct layout_check<end_of_layout, NextIndex>
+{
+    BOOST_STATIC_ASSERT(NextIndex == 4096); // the last run ends at 0xffffffff
+    static const bool value = true;
+};
+
+#define ARM926EJS_SECTION_1(n)    section_descriptor<Layout, (n)>::value
+#define ARM926EJS_SECTION_4(n)    ARM926EJS_SECTION_1(n),         ARM926EJS_SECTION_1((n) + 1),      ARM926EJS_SECTION_1((n) + 2),      ARM926EJS_SECTION_1((n) + 3)
+#define ARM926EJS_SECTION_16(n)   ARM926EJS_SECTION_4(n),         ARM926EJS_SECTION_4((n) + 4),      ARM926EJS_SECTION_4((n) + 8),      ARM926EJS_SECTION_4((n) + 12)
+#define ARM926EJS_SECTION_64(n)   ARM926EJS_SECTION_16(n),        ARM926EJS_SECTION_16((n) + 16),    ARM926EJS_SECTION_16((n) + 32),    ARM926EJS_SECTION_16((n) + 48)
+#define ARM926EJS_SECTION_256(n)  ARM926EJS_SECTION_64(n),        ARM926EJS_SECTION_64((n) + 64),    ARM926EJS_SECTION_64((n) + 128),   ARM926EJS_SECTION_64((n) + 192)
+#define ARM926EJS_SECTION_1024(n) ARM926EJS_SECTION_256(n),       ARM926EJS_SECTION_256((n) + 256),  ARM926EJS_SECTION_256((n) + 512),  ARM926EJS_SECTION_256((n) + 768)
+#define ARM926EJS_SECTION_4096    ARM926EJS_SECTION_1024(0),      ARM926EJS_SECTION_1024(1024),      ARM926EJS_SECTION_1024(2048),      ARM926EJS_SECTION_1024(3072)
+
+template <typename Layout>
+struct section_table
+{
+    BOOST_STATIC_ASSERT(layout_check<Layout>::value);
+    static const u32 entries[4096];
+};
+
+template <typename Layout>
+const u32 section_table<Layout>::entries[4096] __attribute__ ((section (".rodata.page_table"), aligned (16384))) = { ARM926EJS_SECTION_4096 };
+
+#undef ARM926EJS_SECTION_1
+#undef ARM926EJS_SECTION_4
+#undef ARM926EJS_SECTION_16
+#undef ARM926EJS_SECTION_64
+#undef ARM926EJS_SECTION_256
+#undef ARM926EJS_SECTION_1024
+#undef ARM926EJS_SECTION_4096
+
+// the identity mapping of initialize_flat_page_tables, uncached, full access
+typedef layout<section_run<0x00000000, 0xFFFFFFFF, 0x00000000, false, false> > flat_layout;
+
+}
\ No newline at end of file
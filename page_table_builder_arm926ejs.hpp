@@ -0,0 +1,348 @@
+#pragma once
+
+#include "mmu_arm926ejs.hpp"
+
+// the page table construction of install_page_tables, independent of where it runs : the target builds its table in place, and
+// host/page_table_check.cpp builds the same table in a buffer to validate and dump a layout before it ever reaches the board.
+// the table holds the 4096 first level descriptors followed by the second level tables, in the order the first level reserves them.
+// every problem found goes through the Report policy :
+//   void operator()(page_table_error::en error, u32 instruction_index);
+// first level instructions are numbered from 0, second level ones from first_level_size on, and table-wide problems come with
+// first_level_size + second_level_size.
+
+namespace arm926ejs {
+
+namespace page_table_error
+{
+    enum en
+    {
+        no_table = 0,
+        misaligned_table,               // the first level table must be on 16 kB
+        no_instructions,                // a null instruction array with a non-zero size
+        misaligned_range,               // start or end not on the granularity of the descriptors
+        empty_range,                    // end not after start
+        hole,                           // the range does not begin right after the previous one
+        overlap,
+        misaligned_physical,            // the physical address has bits below the granularity of the descriptors
+        misaligned_second_level_table,  // a coarse table must be on 1 kB, a fine table on 4 kB
+        not_in_second_level_table,      // a second level range over a section or a fault
+        tiny_in_coarse,                 // tiny pages only exist in fine tables
+        second_level_overflow,          // more second level descriptors than the first level reserved
+        count,
+    };
+}
+
+static inline const char* get_page_table_error_name(page_table_error::en error)
+{
+    static const char* const names[page_table_error::count] =
+    {
+        "no table",
+        "misaligned table",
+        "no instructions",
+        "misaligned range",
+        "empty range",
+        "hole",
+        "overlap",
+        "misaligned physical address",
+        "misaligned second level table",
+        "not in a second level table",
+        "tiny page in a coarse table",
+        "second level overflow",
+    };
+    return (error < page_table_error::count) ? names[error] : "unknown";
+}
+
+// entries of a table built from these first level instructions : the first level, plus every second level table it reserves
+static inline u32 get_page_table_entries(const first_level_instruction* first_level_inst, u32 first_level_size)
+{
+    u32 entries = 4096;
+    for (u32 i = 0; first_level_inst && i < first_level_size; ++i)
+    {
+        if (first_level_inst[i].start_addr > first_level_inst[i].end_addr)
+            continue;
+        u32 megabytes = (first_level_inst[i].end_addr >> 20) - (first_level_inst[i].start_addr >> 20) + 1;
+        if (first_level_descriptor_type::coarse == first_level_inst[i].type)
+            entries += megabytes * 256;
+        else if (first_level_descriptor_type::fine == first_level_inst[i].type)
+            entries += megabytes * 1024;
+    }
+    return entries;
+}
+
+// table_address is where the MMU sees the table : the second level descriptors in the first level point there.
+// returns the number of entries written, as get_page_table_entries counts them.
+template <typename Report>
+u32 build_page_tables(u32* table, u32 table_address, const first_level_instruction* first_level_inst, u32 first_level_size, const second_level_instruction* second_level_inst, u32 second_level_size, Report& report)
+{
+    const u32 whole_table = first_level_size + second_level_size;
+
+    if (!table)
+    {
+        report(page_table_error::no_table, whole_table);
+        return 0;
+    }
+    if (table_address & 0x3fff)
+        report(page_table_error::misaligned_table, whole_table);
+    if (!first_level_inst || !first_level_size)
+    {
+        report(page_table_error::no_instructions, whole_table);
+        return 0;
+    }
+
+    const u32 table_end = get_page_table_entries(first_level_inst, first_level_size);
+    u32 secondary_table = 4096; // index in table
+    u32 next_megabyte = 0; // hole detector, in megabytes so the last range may end at 0xffffffff
+
+    for (u32 i = 0; i < first_level_size; ++i)
+    {
+        const first_level_instruction& inst = first_level_inst[i];
+
+        if ((inst.start_addr & 0xfffff) != 0 || (inst.end_addr & 0xfffff) != 0xfffff) // aligned on megabytes, end on megabytes minus 1
+            report(page_table_error::misaligned_range, i);
+        if (inst.start_addr >= inst.end_addr)
+        {
+            report(page_table_error::empty_range, i);
+            continue;
+        }
+
+        const u32 first = inst.start_addr >> 20;
+        const u32 last = inst.end_addr >> 20;
+
+        if (first > next_megabyte)
+            report(page_table_error::hole, i);
+        else if (first < next_megabyte)
+            report(page_table_error::overlap, i);
+        next_megabyte = last + 1;
+
+        if (first_level_descriptor_type::section == inst.type && (inst.physical_page_addr & 0xfffff))
+            report(page_table_error::misaligned_physical, i);
+        if (first_level_descriptor_type::fine == inst.type && (secondary_table & 0x3ff))
+            report(page_table_error::misaligned_second_level_table, i);
+
+        for (u32 m = first; m <= last; ++m)
+        {
+            switch (inst.type)
+            {
+            case first_level_descriptor_type::fault:
+                table[m] = 0x00;
+                break;
+            case first_level_descriptor_type::coarse:
+                table[m] = 0x11 | (inst.domain_index << 5) | (table_address + secondary_table * 4);
+                secondary_table += 256;
+                break;
+            case first_level_descriptor_type::section:
+                table[m] = 0x12 |
+                           (inst.bufferable ? 0x4 : 0) |
+                           (inst.cacheable ? 0x8 : 0) |
+                           (inst.domain_index << 5) |
+                           (inst.access << 10) |
+                           (inst.physical_page_addr + ((m - first) << 20));
+                break;
+            case first_level_descriptor_type::fine:
+                table[m] = 0x13 | (inst.domain_index << 5) | (table_address + secondary_table * 4);
+                secondary_table += 1024;
+                break;
+            }
+        }
+    }
+
+    if (next_megabyte != 4096)
+        report(page_table_error::hole, whole_table);
+
+    if (second_level_size && !second_level_inst)
+    {
+        report(page_table_error::no_instructions, whole_table);
+        return secondary_table;
+    }
+
+    secondary_table = 4096;
+
+    for (u32 i = 0; i < second_level_size; ++i)
+    {
+        const second_level_instruction& inst = second_level_inst[i];
+        const u32 index = first_level_size + i;
+
+        const u32 first_level = table[inst.start_addr >> 20];
+        if ((first_level & 0x1) != 1) // make sure it was declared as a coarse or fine table
+        {
+            report(page_table_error::not_in_second_level_table, index);
+            continue;
+        }
+        const first_level_descriptor_type::en type = ((first_level & 0x3) == 0x1) ? first_level_descriptor_type::coarse : first_level_descriptor_type::fine;
+        const u32 descriptor_span = (first_level_descriptor_type::coarse == type) ? 4096 : 1024;
+
+        if ((first_level_descriptor_type::coarse == type) && (second_level_descriptor_size::tiny == inst.size))
+            report(page_table_error::tiny_in_coarse, index);
+
+        u32 addr_mask = descriptor_span - 1;
+        if (second_level_descriptor_size::tiny == inst.size)       addr_mask = 0x3ff;
+        else if (second_level_descriptor_size::small == inst.size) addr_mask = 0xfff;
+        else if (second_level_descriptor_size::large == inst.size) addr_mask = 0xffff;
+
+        if ((inst.start_addr & addr_mask) != 0 || (inst.end_addr & addr_mask) != addr_mask)
+            report(page_table_error::misaligned_range, index);
+        if (inst.start_addr >= inst.end_addr)
+        {
+            report(page_table_error::empty_range, index);
+            continue;
+        }
+        if (second_level_descriptor_size::fault != inst.size && (inst.physical_page_addr & addr_mask))
+            report(page_table_error::misaligned_physical, index);
+
+        // the descriptors are written one after the other : they land where the MMU looks for them only if the instructions
+        // cover the second level tables in order, without a hole
+        const u32 table_base = first_level & ((first_level_descriptor_type::coarse == type) ? 0xfffffc00 : 0xfffff000);
+        const u32 expected = (table_base - table_address) / 4 + ((inst.start_addr & 0xfffff) / descriptor_span);
+        if (secondary_table < expected)
+            report(page_table_error::hole, index);
+        else if (secondary_table > expected)
+            report(page_table_error::overlap, index);
+
+        u32 value = 0;
+        switch (inst.size)
+        {
+        case second_level_descriptor_size::fault:
+            value = 0x0;
+            break;
+        case second_level_descriptor_size::large:
+            value = 0x1 |
+                    (inst.bufferable ? 0x4 : 0) |
+                    (inst.cacheable ? 0x8 : 0) |
+                    (inst.access_0 << 4)  |
+                    (inst.access_1 << 6)  |
+                    (inst.access_2 << 8)  |
+                    (inst.access_3 << 10) |
+                    inst.physical_page_addr;
+            break;
+        case second_level_descriptor_size::small:
+            value = 0x2 |
+                    (inst.bufferable ? 0x4 : 0) |
+                    (inst.cacheable ? 0x8 : 0) |
+                    (inst.access_0 << 4)  |
+                    (inst.access_1 << 6)  |
+                    (inst.access_2 << 8)  |
+                    (inst.access_3 << 10) |
+                    inst.physical_page_addr;
+            break;
+        case second_level_descriptor_size::tiny:
+            value = 0x3 |
+                    (inst.bufferable ? 0x4 : 0) |
+                    (inst.cacheable ? 0x8 : 0) |
+                    (inst.access_0 << 4)  |
+                    inst.physical_page_addr;
+            break;
+        }
+
+        const u32 descriptors = (inst.end_addr - inst.start_addr) / descriptor_span + 1;
+        if (descriptors > table_end - secondary_table)
+        {
+            report(page_table_error::second_level_overflow, index);
+            continue;
+        }
+        // a page larger than the span of a descriptor is repeated in every descriptor it covers, its physical address only
+        // moves from one page to the next
+        for (u32 d = 0; d < descriptors; ++d)
+            table[secondary_table + d] = value + ((d * descriptor_span) & ~addr_mask);
+
+        secondary_table += descriptors;
+    }
+
+    return table_end;
+}
+
+// what the MMU makes of one virtual address, read back from a built table
+struct translation
+{
+    u32 virtual_addr;                       // first address of the (sub)page holding the looked-up address
+    u32 size;                               // bytes sharing the same translation and permissions
+    u32 physical_addr;                      // where virtual_addr lands
+    first_level_descriptor_type::en type;   // fault, section, or the kind of second level table
+    second_level_descriptor_size::en page;  // of coarse and fine tables only
+    bool cacheable;
+    bool bufferable;
+    access_permission::en access;
+    u8 domain_index;
+};
+
+// false when the second level table of the address is outside the table_entries of the table
+static inline bool translate(const u32* table, u32 table_address, u32 table_entries, u32 virtual_addr, translation& t)
+{
+    const u32 first_level = table[virtual_addr >> 20];
+
+    t.type = static_cast<first_level_descriptor_type::en>(first_level & 0x3);
+    t.page = second_level_descriptor_size::fault;
+    t.domain_index = (first_level >> 5) & 0xf;
+    t.virtual_addr = virtual_addr & 0xfff00000;
+    t.size = 0x100000;
+    t.physical_addr = 0;
+    t.cacheable = false;
+    t.bufferable = false;
+    t.access = access_permission::use_s_r;
+
+    switch (t.type)
+    {
+    case first_level_descriptor_type::fault:
+        t.domain_index = 0;
+        return true;
+    case first_level_descriptor_type::section:
+        t.physical_addr = first_level & 0xfff00000;
+        t.cacheable = (first_level & 0x8) != 0;
+        t.bufferable = (first_level & 0x4) != 0;
+        t.access = static_cast<access_permission::en>((first_level >> 10) & 0x3);
+        return true;
+    default:
+        break;
+    }
+
+    u32 table_base, entry;
+    if (first_level_descriptor_type::coarse == t.type)
+    {
+        table_base = first_level & 0xfffffc00;
+        entry = (virtual_addr >> 12) & 0xff;
+        t.size = 4096;
+    }
+    else
+    {
+        table_base = first_level & 0xfffff000;
+        entry = (virtual_addr >> 10) & 0x3ff;
+        t.size = 1024;
+    }
+    t.virtual_addr = virtual_addr & ~(t.size - 1);
+
+    if (table_base < table_address || ((table_base - table_address) / 4) + entry >= table_entries)
+        return false;
+
+    const u32 second_level = table[(table_base - table_address) / 4 + entry];
+    t.page = static_cast<second_level_descriptor_size::en>(second_level & 0x3);
+    t.cacheable = (second_level & 0x8) != 0;
+    t.bufferable = (second_level & 0x4) != 0;
+
+    u32 subpage;
+    switch (t.page)
+    {
+    case second_level_descriptor_size::fault:
+        t.cacheable = false;
+        t.bufferable = false;
+        return true;
+    case second_level_descriptor_size::large: // 4 subpages of 16 kB
+        subpage = (virtual_addr >> 14) & 0x3;
+        t.size = 0x4000;
+        t.physical_addr = (second_level & 0xffff0000) + (subpage << 14);
+        break;
+    case second_level_descriptor_size::small: // 4 subpages of 1 kB
+        subpage = (virtual_addr >> 10) & 0x3;
+        t.size = 0x400;
+        t.physical_addr = (second_level & 0xfffff000) + (subpage << 10);
+        break;
+    default: // tiny, one permission for the whole kB
+        subpage = 0;
+        t.size = 0x400;
+        t.physical_addr = second_level & 0xfffffc00;
+        break;
+    }
+    t.virtual_addr = virtual_addr & ~(t.size - 1);
+    t.access = static_cast<access_permission::en>((second_level >> (4 + subpage * 2)) & 0x3);
+    return true;
+}
+
+}
\ No newline at end of file
@@ -0,0 +1,238 @@
+#pragma once
+
+#include "armtastic/types.hpp"
+#include "interrupt_lpc3230.hpp"
+#include "fiq_lpc3230.hpp"
+#include "uart_client.hpp"
+#include "targets/LPC3200.h"
+#include <ctl_api.h>
+
+namespace lpc3230
+{
+
+namespace profiling
+{
+    // record types of the sample stream. all fields are little endian.
+    namespace record
+    {
+        enum en
+        {
+            start = 0xA4,       // u32 sampling rate in Hz. sent first, and again after each start(). forgets the declared tasks
+            sample = 0xA5,      // u32 interrupted pc, u8 task index (0xFF when no task was running)
+            task = 0xA6,        // u8 task index, u8 name length, name. sent before the first sample of each task since the last start
+            overflow = 0xA7,    // u16 samples dropped because the ring buffer was full
+        };
+    }
+
+    // statistical profiler : timer 2 interrupts on the FIQ fast path, which latches the interrupted pc and the running CTL task.
+    // the samples are streamed by acting as the client of a spare uart. host/pc_profile turns a capture into a flat profile.
+    // the sampling period is dithered by a few microseconds so it does not lock onto periodic tasks.
+    class pc_sampler : public uart_client
+    {
+    public:
+        pc_sampler() : write(0), read(0), dropped(0), reported_dropped(0), rate(0), base_match(0), lfsr(1), task_count(0), record_length(0), record_pos(0), send_start(false) {}
+
+        // false for a rate the dithered timer cannot reach : above periph_clock / min_period_cycles, about 100 kHz at 13 MHz
+        bool init(u32 periph_clock, u32 sample_rate)
+        {
+            if (!sample_rate || periph_clock / sample_rate < min_period_cycles)
+                return false;
+
+            rate = sample_rate;
+            base_match = periph_clock / sample_rate - jitter_mask - 1;
+
+            TIMCLK_CTRL1 |= 0x10; // Power timer 2
+            // Reset counter and disable it
+            T2TCR &= 0xFE;
+            T2TCR |= 0x2;
+            T2TCR &= 0xFD;
+
+            // Clear match interrupt
+            T2IR |= 0x1;
+
+            // Count mode positive clock edge
+            T2CTCR &= 0xFFFFFFFC;
+
+            // No prescaler
+            T2PC = 0;
+
+            T2MR0 = base_match;
+
+            // Interrupt and reset on match reg 0
+            T2MCR = (T2MCR & ~0x7) | 0x3;
+
+            return interrupt::fiq::install(interrupt::id::timer_2, interrupt::trigger::high_level, fast_isr, this);
+        }
+
+        // the task table starts over : a host joining the stream at this start record gets every task declared again
+        void start()
+        {
+            // the FIQ is off until the counter runs, only the uart interrupt encoding records reads the table meanwhile
+            int enabled = ctl_global_interrupts_disable();
+            task_count = 0;
+            send_start = true;
+            ctl_global_interrupts_set(enabled);
+            interrupt::fiq::enable(interrupt::id::timer_2);
+            T2TCR |= 0x1; // Enable the counter
+        }
+
+        void stop()
+        {
+            T2TCR &= 0xFE; // Disable the counter
+            interrupt::fiq::disable(interrupt::id::timer_2);
+        }
+
+        // call periodically from a low priority task : the uart only pulls from us while its fifo drains, it must be kicked once it went idle
+        template <typename Uart>
+        void flush(Uart& uart)
+        {
+            if (write != read || send_start)
+                uart.trigger_transmit();
+        }
+
+        virtual bool get_byte(u8* byte)
+        {
+            if (record_pos >= record_length && !next_record())
+                return false;
+            if (!byte)
+                return true;
+            *byte = record_buffer[record_pos++];
+            return record_pos < record_length || next_record();
+        }
+
+        virtual bool set_byte(u8* byte) { return true; } // nothing to receive, drop it
+        virtual void receive_event() {}
+        virtual void error_event(u8 error) {}
+
+    private:
+        struct sample_entry
+        {
+            u32 pc;
+            CTL_TASK_t* task;
+        };
+
+        static void fast_isr(void* context, u32 interrupted_pc)
+        {
+            pc_sampler* self = static_cast<pc_sampler*>(context);
+            T2IR = 0x1; // Clear match interrupt, the source is level triggered
+
+            // galois lfsr, x^16 + x^14 + x^13 + x^11 + 1
+            self->lfsr = (self->lfsr >> 1) ^ (-(self->lfsr & 1u) & 0xB400u);
+            T2MR0 = self->base_match + (self->lfsr & jitter_mask);
+
+            u16 next = (self->write + 1) & (ring_size - 1);
+            if (next == self->read)
+            {
+                ++self->dropped;
+                return;
+            }
+            sample_entry& entry = self->samples[self->write];
+            entry.pc = interrupted_pc;
+            entry.task = ctl_task_executing;
+            self->write = next;
+        }
+
+        // encodes the next record, called from the uart interrupt. single consumer of the ring buffer.
+        bool next_record()
+        {
+            record_pos = 0;
+            record_length = 0;
+
+            if (send_start)
+            {
+                send_start = false;
+                record_buffer[record_length++] = record::start;
+                put_u32(rate);
+                return true;
+            }
+
+            if (dropped != reported_dropped)
+            {
+                u32 count = dropped - reported_dropped; // only the FIQ writes dropped, only we write reported_dropped : no locking
+                if (count > 0xFFFF)
+                    count = 0xFFFF;
+                reported_dropped += count;
+                record_buffer[record_length++] = record::overflow;
+                record_buffer[record_length++] = count & 0xFF;
+                record_buffer[record_length++] = count >> 8;
+                return true;
+            }
+
+            if (read == write)
+                return false;
+
+            const sample_entry& entry = samples[read];
+            u8 index = no_task;
+            if (entry.task)
+            {
+                index = find_task(entry.task);
+                if (index == task_count && task_count < max_tasks) // first sample of that task : declare it, the sample goes out with the next record
+                {
+                    tasks[task_count++] = entry.task;
+                    record_buffer[record_length++] = record::task;
+                    record_buffer[record_length++] = index;
+                    const char* name = entry.task->name ? entry.task->name : "";
+                    u8 length = 0;
+                    while (name[length] && length < max_name_length)
+                        ++length;
+                    record_buffer[record_length++] = length;
+                    for (u8 i = 0; i < length; ++i)
+                        record_buffer[record_length++] = name[i];
+                    return true;
+                }
+                if (index >= max_tasks)
+                    index = no_task;
+            }
+
+            record_buffer[record_length++] = record::sample;
+            put_u32(entry.pc);
+            record_buffer[record_length++] = index;
+            read = (read + 1) & (ring_size - 1);
+            return true;
+        }
+
+        u8 find_task(CTL_TASK_t* task)
+        {
+            u8 i = 0;
+            while (i < task_count && tasks[i] != task)
+                ++i;
+            return i;
+        }
+
+        void put_u32(u32 value)
+        {
+            for (u8 i = 0; i < 4; ++i)
+            {
+                record_buffer[record_length++] = value & 0xFF;
+                value >>= 8;
+            }
+        }
+
+        static const u16 ring_size = 512; // must be a power of 2
+        static const u32 jitter_mask = 0x3F; // up to 63 periph_clock cycles of dither, about 5 us at 13 MHz
+        static const u32 min_period_cycles = 2 * (jitter_mask + 1); // the dither stays within half the period, and base_match above 0
+        static const u8 max_tasks = 32;
+        static const u8 no_task = 0xFF;
+        static const u8 max_name_length = 32;
+
+        sample_entry samples[ring_size];
+        volatile u16 write;
+        volatile u16 read;
+        volatile u32 dropped;
+        u32 reported_dropped;
+
+        u32 rate;
+        u32 base_match;
+        u32 lfsr;
+
+        CTL_TASK_t* tasks[max_tasks];
+        u8 task_count;
+
+        u8 record_buffer[3 + max_name_length];
+        u8 record_length;
+        u8 record_pos;
+        volatile bool send_start;
+    };
+}
+
+}
\ No newline at end of file
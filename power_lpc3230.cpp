@@ -0,0 +1,82 @@
+#include "power_lpc3230.hpp"
+#include "registers_lpc3230.hpp"
+#include "ddr_timing_lpc3230.hpp"
+#include "targets/LPC3200.h"
+#include "modules/init/globals.hpp"
+#include <libarm.h>
+
+namespace lpc3230
+{
+
+namespace power
+{
+    // raw addresses only below : the register objects live in DDR, which is not readable while in self-refresh
+    static volatile u32* const start_internal_enable = reinterpret_cast<volatile u32*>(clock::base_addr + clock::offset::start_internal);
+    static volatile u32* const start_internal_raw_status = reinterpret_cast<volatile u32*>(clock::base_addr + clock::offset::start_internal_raw_status);
+    static volatile u32* const start_pin_enable = reinterpret_cast<volatile u32*>(clock::base_addr + clock::offset::start_pin);
+    static volatile u32* const start_pin_raw_status = reinterpret_cast<volatile u32*>(clock::base_addr + clock::offset::start_pin_raw_status);
+    static volatile u32* const high_speed_counter = reinterpret_cast<volatile u32*>(high_speed_timer::base_addr + high_speed_timer::offset::counter);
+
+    void sleep(mode::en m, const wake_sources& wake)
+    {
+        if (mode::run == m)
+            return;
+
+        // the EMC counts tXSR itself, but only in EMC cycles of the clock it runs at when leaving self-refresh : wait it out on the periph clock as well
+        typedef emc::ddr_part ddr;
+        u32 exit_ns = (ddr::tXSR > ddr::tSREX) ? ddr::tXSR : ddr::tSREX;
+        u32 periph_freq = get_hw_clock().get_periph_freq();
+        u32 exit_ticks = (exit_ns * (periph_freq / 1000000) + 999) / 1000 + 1; // round up, plus one tick for the counter phase
+
+        int state = libarm_disable_irq_fiq();
+        enter_low_power(mode::stop == m, wake.internal, wake.pins, exit_ticks);
+        libarm_restore_irq_fiq(state);
+    }
+
+    void enter_low_power(bool stop, u32 internal_wake, u32 pin_wake, u32 self_refresh_exit_ticks)
+    {
+        u32 hclkpll = HCLKPLL_CTRL;
+
+        if (stop)
+        {
+            *start_internal_raw_status = 0xFFFFFFFF; // drop stale events, they would wake us right away
+            *start_pin_raw_status = 0xFFFFFFFF;
+            *start_internal_enable = internal_wake;
+            *start_pin_enable = pin_wake;
+        }
+
+        // the DDR clock is gone as soon as we leave RUN mode : put the DDR in self-refresh first
+        EMCDynamicControl |= 0x00000004;
+        while (!(EMCStatus & 0x00000004));
+
+        PWR_CTRL &= ~0x00000004; // Direct RUN mode, everything runs from sysclk
+        HCLKPLL_CTRL = hclkpll & ~0x00010000; // power the PLL down
+
+        if (stop)
+        {
+            PWR_CTRL |= 0x00000001; // all clocks stop here until a start event
+            PWR_CTRL &= ~0x00000001;
+        }
+        else
+            __asm__ volatile("MCR p15, 0, %0, c7, c0, 4" : : "r"(0) : "memory"); // wait for interrupt. not cp15_wait_for_interrupt : an out-of-line copy would live in DDR
+
+        HCLKPLL_CTRL = hclkpll;
+        while (!(HCLKPLL_CTRL & 0x1)); // await PLL lock down
+        PWR_CTRL |= 0x00000004; // back to RUN mode
+
+        EMCDynamicControl &= ~0x00000004; // self-refresh exit
+        while (EMCStatus & 0x00000004);
+
+        // no access may reach the DDR before tXSR is over
+        u32 start = *high_speed_counter;
+        while (*high_speed_counter - start < self_refresh_exit_ticks);
+
+        if (stop)
+        {
+            *start_internal_enable = 0;
+            *start_pin_enable = 0;
+        }
+    }
+}
+
+}
\ No newline at end of file
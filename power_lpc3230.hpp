@@ -0,0 +1,37 @@
+#pragma once
+
+#include "armtastic/types.hpp"
+
+namespace lpc3230
+{
+
+namespace power
+{
+    namespace mode
+    {
+        enum en
+        {
+            run,            // ARM, HCLK and DDR from the HCLK PLL. the normal mode, and the one sleep() returns to
+            direct_run,     // everything from sysclk, the PLL powered down and the DDR in self-refresh. the core waits for an interrupt
+            stop,           // all clocks stopped until an event of the start controller
+        };
+    }
+
+    // raw enable masks of the start controller : internal sources (start_internal, 0x40004020) and pins (start_pin, 0x40004030),
+    // see the user manual for the bit of each UART receive line or GPIO. only used to leave STOP mode, any enabled interrupt ends a Direct RUN sleep.
+    struct wake_sources
+    {
+        u32 internal;
+        u32 pins;
+    };
+
+    // drops to the given low power mode until a wake source fires, then returns in RUN mode, with the DDR back out of self-refresh.
+    // interrupts are held off meanwhile : the one which woke us up is served when this returns.
+    // the data cache must not have to evict a dirty line in the meantime, so call it with a stack in internal RAM or a clean cache.
+    void sleep(mode::en m, const wake_sources& wake);
+
+    // the part running while the DDR is in self-refresh, from internal RAM. self_refresh_exit_ticks is tXSR in high speed timer ticks.
+    void enter_low_power(bool stop, u32 internal_wake, u32 pin_wake, u32 self_refresh_exit_ticks) __attribute__ ((section (".reset")));
+}
+
+}
\ No newline at end of file
@@ -5,6 +5,7 @@
 #include "interrupt_lpc3230.hpp"
 #include "timer_lpc3230.hpp"
 #include "dma_lpc3230.hpp"
+#include "clock_client.hpp"
 #include "modules/init/globals.hpp"
 
 #if !defined(NO_CACHE_ENABLE) && ENABLE_SD_DMA // cache is enabled, and we use dma
@@ -16,6 +17,10 @@
     #endif
 #endif
 
+#if ENABLE_SD_DMA
+    #include "dma_buffer_pool_lpc3230.hpp"
+#endif
+
 #if ENABLE_SD_STATS
     #include "modules/debug/debug_io.hpp"
 #endif
@@ -276,7 +281,7 @@ namespace sd
         #endif
     #endif
 
-    class controller
+    class controller : public clock_client
     {
     public:
         controller() : inserted(false), command_state(command_states::idle), receive_state(receive_states::idle), transmit_state(transmit_states::idle), unknown_transmit_status(false), current_data(0), command_done_mask(0), transfer_done_mask(0), error_mask(0), event(0) {}
@@ -298,7 +303,9 @@ namespace sd
             regs.power.control = 0x3; // power on, enable output pins
             regs.power.open_drain = false; // SD card are push-pull. Open drain is used when we need to detect if a SD or MMC card is inserted, this is not our case.
 
-            regs.clock.divider = compute_divider(400000); // 400 kHz to initialize the memory card. not tested, based on unclear literature (no spec available to us). a higher rate may work.
+            current_clock_rate = 400000;
+            get_hw_clock().add_client(*this);
+            regs.clock.divider = compute_divider(current_clock_rate, get_hw_clock().get_arm_freq()); // 400 kHz to initialize the memory card. not tested, based on unclear literature (no spec available to us). a higher rate may work.
             regs.clock.enable = true;
             regs.clock.power_save = false;
             regs.clock.bypass = false;
@@ -318,7 +325,7 @@ namespace sd
             regs.int_mask_0.write(0);
             regs.int_mask_1.write(0);
 
-            get_int_ctrl().install_service_routine(interrupt::id::sd_0, cmd_int_priority, fast_irq, interrupt::trigger::high_level, static_command_isr);
+            get_int_ctrl().install_service_routine(interrupt::id::sd_0, cmd_int_priority, fast_irq, interrupt::trigger::high_level, interrupt::member_thunk<controller, &controller::command_isr>, this);
             data_int_prio = data_int_priority;
 
             issue_command(commands::idle);
@@ -347,10 +354,10 @@ namespace sd
                 //current_clock_rate = 50000000; // maximum spec'ed data rate for SD - causes some transmit FIFO underruns. possible fix : use static ram for the DMA buffer instead of DDR
                 //current_clock_rate = 25000000; // half the max spec, causes many start bit errors on receive... why?
                 current_clock_rate = 45000000; // when set on static ram, will get underruns from time to time, they are fixed by retries
-                regs.clock.divider = compute_divider(current_clock_rate);
+                regs.clock.divider = compute_divider(current_clock_rate, get_hw_clock().get_arm_freq());
             #else
                 current_clock_rate = 1000000;  // tested maximum rate we can go when copying data manually
-                regs.clock.divider = compute_divider(current_clock_rate); // about the fastest safe value in manual IO. faster, and we'll have transmit FIFO underrun errors
+                regs.clock.divider = compute_divider(current_clock_rate, get_hw_clock().get_arm_freq()); // about the fastest safe value in manual IO. faster, and we'll have transmit FIFO underrun errors
             #endif
 
             issue_command(commands::all_send_cid); // not really needed, could be removed if it still works
@@ -404,6 +411,11 @@ namespace sd
         template<typename T>
         void unused(T const &) { } // suppresses 'unused variable' warnings
 
+        #if ENABLE_CACHE_COHERENCE
+            // buffers from a dma::buffer_pool are reached through the uncached window and never sit in the data cache
+            static bool cached(const u8* buffer) { return !dma::get_uncached_window().contains(buffer); }
+        #endif
+
         bool read_block(u32 block, u8* buffer)
         {
             current_data = reinterpret_cast<u32*>(buffer);
@@ -414,9 +426,14 @@ namespace sd
                 unused(tmp);
             }
 
+            #if ENABLE_CACHE_COHERENCE
+                if (cached(buffer))
+                    cp15_invalidate_data_cache_range(buffer, buffer + block_size); // no dirty line may be evicted over the incoming data
+            #endif
             issue_command(commands::read_single, block * block_size);
             #if ENABLE_CACHE_COHERENCE
-                cp15_force_cache_coherence(reinterpret_cast<u32*>(buffer), reinterpret_cast<u32*>(buffer + block_size));
+                if (cached(buffer))
+                    cp15_invalidate_data_cache_range(buffer, buffer + block_size);
             #endif
 
             #if !ENABLE_SD_CONSISTENCY
@@ -428,7 +445,8 @@ namespace sd
                 memcpy(consistency_buf, buffer, block_size);
                 memset(buffer, 0, block_size);
                 #if ENABLE_CACHE_COHERENCE
-                    cp15_force_cache_coherence(reinterpret_cast<u32*>(buffer), reinterpret_cast<u32*>(buffer + block_size));
+                    if (cached(buffer))
+                        cp15_clean_invalidate_data_cache_range(buffer, buffer + block_size); // the zeros must reach memory : a second read that writes nothing shows
                 #endif
 
                 current_data = reinterpret_cast<u32*>(buffer);
@@ -442,7 +460,8 @@ namespace sd
 
                 issue_command(commands::read_single, block * block_size);
                 #if ENABLE_CACHE_COHERENCE
-                    cp15_force_cache_coherence(reinterpret_cast<u32*>(buffer), reinterpret_cast<u32*>(buffer + block_size));
+                    if (cached(buffer))
+                        cp15_invalidate_data_cache_range(buffer, buffer + block_size);
                 #endif
 
                 if (error())
@@ -469,7 +488,10 @@ namespace sd
             to_send = block_size * block_count;
 
             #if ENABLE_CACHE_COHERENCE
-                cp15_force_cache_coherence(reinterpret_cast<u32*>(buffer), reinterpret_cast<u32*>(buffer + block_size * block_count));
+                if (cached(buffer))
+                    cp15_clean_data_cache_range(buffer, buffer + block_size * block_count);
+                else
+                    cp15_drain_write_buffer(); // the last writes to an uncached buffer may still sit in the write buffer
             #endif
             assert_fs_safe(block_count > 0);
             if (block_count == 1)
@@ -503,7 +525,8 @@ namespace sd
                     issue_command(commands::read_single, (start_block + b) * block_size);
                 }
                 #if ENABLE_CACHE_COHERENCE
-                    cp15_force_cache_coherence(reinterpret_cast<u32*>(buffer), reinterpret_cast<u32*>(buffer + block_size * block_count));
+                    if (cached(buffer))
+                        cp15_invalidate_data_cache_range(buffer, buffer + block_size * block_count); // the lines are clean since the write, nothing to lose
                 #endif
 
                 if (error())
@@ -682,10 +705,6 @@ namespace sd
         #endif // SD_DEBUG
 
     private:
-        static void static_command_isr()
-        {
-            get_sd().command_isr();
-        }
         void command_isr()
         {
             bool error = false;
@@ -734,7 +753,7 @@ namespace sd
                     regs.int_mask_1.transmit_fifo_underrun = true;
                     regs.int_mask_1.data_timeout = true;
                     regs.int_mask_1.data_crc_failed = true;
-                    get_dma().enable_sd_transmit<1>(current_data, reinterpret_cast<u32*>(base_addr::base + offset::fifo_begin), 0);
+                    get_dma().enable_sd_transmit<1>(reinterpret_cast<u32*>(dma::get_uncached_window().to_physical(current_data)), reinterpret_cast<u32*>(base_addr::base + offset::fifo_begin), 0);
                 #else
                     regs.int_mask_1.write(0);
                     regs.int_mask_1.transmit_fifo_half_empty = true;
@@ -778,10 +797,6 @@ namespace sd
             }
         }
 
-        static void static_transmit_isr()
-        {
-            get_sd().transmit_isr();
-        }
         void transmit_isr()
         {
             bool done = false, error = false;
@@ -848,10 +863,6 @@ namespace sd
             regs.clear.data_crc_failed = true;
         }
 
-        static void static_receive_isr()
-        {
-            get_sd().receive_isr();
-        }
         void receive_isr()
         {
             bool done = false, error = false;
@@ -915,10 +926,6 @@ namespace sd
             regs.clear.data_crc_failed = true;
         }
 
-        static void static_dma_transmit_isr()
-        {
-            get_sd().dma_transmit_isr();
-        }
         void dma_transmit_isr()
         {
             bool done = false, error = false;
@@ -974,10 +981,6 @@ namespace sd
             regs.clear.data_crc_failed = true;
         }
 
-        static void static_dma_receive_isr()
-        {
-            get_sd().dma_receive_isr();
-        }
         void dma_receive_isr()
         {
             bool done = false, error = false;
@@ -1143,9 +1146,9 @@ namespace sd
             if (commands::write_single == cmd || commands::write_multiple == cmd)
             {
                 #if ENABLE_SD_DMA
-                    get_int_ctrl().install_service_routine(interrupt::id::sd_1, data_int_prio, false, interrupt::trigger::high_level, static_dma_transmit_isr);
+                    get_int_ctrl().install_service_routine(interrupt::id::sd_1, data_int_prio, false, interrupt::trigger::high_level, interrupt::member_thunk<controller, &controller::dma_transmit_isr>, this);
                 #else
-                    get_int_ctrl().install_service_routine(interrupt::id::sd_1, data_int_prio, false, interrupt::trigger::high_level, static_transmit_isr);
+                    get_int_ctrl().install_service_routine(interrupt::id::sd_1, data_int_prio, false, interrupt::trigger::high_level, interrupt::member_thunk<controller, &controller::transmit_isr>, this);
                 #endif
                 get_int_ctrl().enable_interrupt(interrupt::id::sd_1);
                 regs.data_timer = worst_case_timeout * (to_send / block_size);
@@ -1159,15 +1162,15 @@ namespace sd
             {
                 regs.int_mask_1.write(0);
                 #if ENABLE_SD_DMA
-                    get_dma().enable_sd_receive<0>(reinterpret_cast<u32*>(base_addr::base + offset::fifo_begin), current_data, 0);
+                    get_dma().enable_sd_receive<0>(reinterpret_cast<u32*>(base_addr::base + offset::fifo_begin), reinterpret_cast<u32*>(dma::get_uncached_window().to_physical(current_data)), 0);
                     regs.clear.data_end = true;
                     regs.int_mask_1.data_end = true;
-                    get_int_ctrl().install_service_routine(interrupt::id::sd_1, data_int_prio, false, interrupt::trigger::high_level, static_dma_receive_isr);
+                    get_int_ctrl().install_service_routine(interrupt::id::sd_1, data_int_prio, false, interrupt::trigger::high_level, interrupt::member_thunk<controller, &controller::dma_receive_isr>, this);
                 #else
                     regs.clear.data_block_end = true;
                     regs.int_mask_1.receive_fifo_half_full = true;
                     regs.int_mask_1.data_block_end = true;
-                    get_int_ctrl().install_service_routine(interrupt::id::sd_1, data_int_prio, false, interrupt::trigger::high_level, static_receive_isr);
+                    get_int_ctrl().install_service_routine(interrupt::id::sd_1, data_int_prio, false, interrupt::trigger::high_level, interrupt::member_thunk<controller, &controller::receive_isr>, this);
                 #endif
                 get_int_ctrl().enable_interrupt(interrupt::id::sd_1);
                 regs.clear.start_bit_error = true;
@@ -1367,9 +1370,19 @@ namespace sd
             }
         }
 
-        u8 compute_divider(u32 clock_rate) // divider is 8-bit wide
+        // the card clock must never exceed the rate it was set to : while the ARM clock changes, divide for the faster of both clocks
+        virtual void prepare_frequency_change(const clock::frequencies& current, const clock::frequencies& next)
+        {
+            regs.clock.divider = compute_divider(current_clock_rate, (current.arm > next.arm) ? current.arm : next.arm);
+        }
+
+        virtual void frequency_changed(const clock::frequencies& current)
+        {
+            regs.clock.divider = compute_divider(current_clock_rate, current.arm);
+        }
+
+        u8 compute_divider(u32 clock_rate, u32 input_clock) // divider is 8-bit wide. input clock rate : ARM clk, since we chose a by-1 divider in ms_control register
         {
-            u32 input_clock = get_hw_clock().get_arm_freq(); // Get SD module input clock rate : ARM clk, since we chose a by-1 divider in ms_control register
 
             // Find best divider to generate target clock rate
             u32 sd_div = 0;
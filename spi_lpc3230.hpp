@@ -5,6 +5,7 @@
 #include "registers_lpc3230.hpp"
 #include "interrupt_lpc3230.hpp"
 #include "clock_lpc3230.hpp"
+#include "clock_client.hpp"
 #include "assert.h"
 #include "modules/async/delayed_result.hpp"
 
@@ -36,10 +37,10 @@ namespace spi
         };
     }
 
-    class controller
+    class controller : public clock_client
     {
     public:
-        controller() : data(0), status(state::idle), idle_mask(0) {}
+        controller() : data(0), status(state::idle), idle_mask(0), bit_rate(0) {}
 
         void init(u8 spi_int_priority, bool fast_spi_irq, u8 aux_int_priority, bool fast_aux_irq)
         {
@@ -55,7 +56,9 @@ namespace spi
 
             // Aux controller supports up to 16.6 mbps. If the other devices cannot go as high, we may need to reprogram the rate for each transfer depending on the target
             //regs.control.rate = compute_rate(16100000); // effective rate will be 12.5Mbps, this divider is applied directly on the h_clock, so it's not very precise for high rates
-            regs.control.rate = compute_rate(8000000);
+            bit_rate = 8000000;
+            regs.control.rate = compute_rate(bit_rate, get_hw_clock().get_h_freq());
+            get_hw_clock().add_client(*this);
             regs.control.master = true;
             regs.control.bitnum = 0xF; // 16 bits
             regs.control.shift_off = false; // enable the clock output
@@ -80,7 +83,7 @@ namespace spi
             //get_int_ctrl().enable_interrupt(interrupt::id::spi_1);
 
             // register the auxiliary controller interrupt handler (tells us when data is ready)
-            get_int_ctrl().install_service_routine(interrupt::id::aux_ctrl_spi, aux_int_priority, fast_aux_irq, interrupt::trigger::positive_edge, static_aux_isr);
+            get_int_ctrl().install_service_routine(interrupt::id::aux_ctrl_spi, aux_int_priority, fast_aux_irq, interrupt::trigger::positive_edge, interrupt::member_thunk<controller, &controller::aux_isr>, this);
             get_int_ctrl().enable_interrupt(interrupt::id::aux_ctrl_spi);
         }
 
@@ -136,11 +139,6 @@ namespace spi
         }
 
     private:
-        static void static_aux_isr()
-        {
-            get_spi_ctrl().aux_isr();
-        }
-
         void aux_isr()
         {
             switch (status)
@@ -203,9 +201,19 @@ namespace spi
             }
         }
 
-        u8 compute_rate(u32 bps)
+        // the divider applies to HCLK : while it changes, divide for the faster of both clocks so devices are never clocked over their rate
+        virtual void prepare_frequency_change(const clock::frequencies& current, const clock::frequencies& next)
+        {
+            regs.control.rate = compute_rate(bit_rate, (current.h > next.h) ? current.h : next.h);
+        }
+
+        virtual void frequency_changed(const clock::frequencies& current)
+        {
+            regs.control.rate = compute_rate(bit_rate, current.h);
+        }
+
+        u8 compute_rate(u32 bps, u32 h_freq)
         {
-            u32 h_freq = get_hw_clock().get_h_freq();
             u32 division_needed = (h_freq / bps) + 2; // better to divide a little more than not enough
             u8 rate = (division_needed / 2);
             if (rate > 0)
@@ -217,6 +225,7 @@ namespace spi
         volatile state::en status;
         CTL_EVENT_SET_t idle_mask;
         CTL_EVENT_SET_t* event;
+        u32 bit_rate;
     };
 }
 
@@ -2,6 +2,7 @@
 #include "interrupt_lpc3230.hpp"
 #include "emc_lpc3230.hpp"
 #include "targets/LPC3200.h"
+#include "cp15_arm926ejs.hpp"
 #include "modules/init/globals.hpp"
 
 namespace lpc3230
@@ -47,21 +48,126 @@ namespace standard_timer
         TIMCLK_CTRL1 &= 0xFFFFFFFB;
     }
 
+    void timer_0_start_count()
+    {
+        // Power timer 0
+        TIMCLK_CTRL1 |= 0x4;
+    
+        // Reset counter and disable it
+        T0TCR &= 0xFE;
+        T0TCR |= 0x2;
+        T0TCR &= 0xFD;
+
+        // Count mode positive clock edge
+        T0CTCR &= 0xFFFFFFFC;
+    
+        // No prescaler
+        T0PC = 0;
+
+        // No action on match, count freely
+        T0MCR &= ~0x7;
+    
+        // Enable the counter
+        T0TCR |= 0x1;
+    }
+
+    u32 timer_0_get_count()
+    {
+        return T0TC;
+    }
+
+    void timer_0_stop_count()
+    {
+        // Disable the timer
+        T0TCR &= 0xFE;
+    
+        // Disable power to timer
+        TIMCLK_CTRL1 &= 0xFFFFFFFB;
+    }
+
     static u32 ddr_calibration_counter = 0;
 
+    // timer 1 runs free : the match register is moved forward instead of resetting the counter, so sleeping for several ticks
+    // and accounting for them afterwards needs no other time source
+    static u32 cycles_per_tick;
+    static u32 last_tick_count; // counter value at the last tick reported to the CTL
+    static const u32 max_sleep_cycles = 0x40000000; // well within the range where the counter difference is unambiguous
+
+    // program the match for the first tick boundary after the counter, never in the past : it would only fire after a full counter wrap
+    static void program_next_tick(u32 ticks_ahead)
+    {
+        u32 match = last_tick_count + ((T1TC - last_tick_count) / cycles_per_tick + ticks_ahead) * cycles_per_tick;
+        T1MR0 = match;
+        if (static_cast<s32>(match - T1TC) <= 0) // crossed while we were here
+            T1MR0 = T1TC + 1; // the timer raises it right away
+    }
+
     void ctl_timer_isr()
     {
-        if (ddr_calibration_counter >= 1000) // once every second
+        // Clear match interrupt
+        T1IR |= 0x1;
+
+        // report all the ticks elapsed since the last match in one go : more than one after a tickless sleep
+        u32 ticks = (T1TC - last_tick_count) / cycles_per_tick;
+        if (ticks)
         {
-            emc::start_calibration_cycle();
-            ddr_calibration_counter = 0;
+            last_tick_count += ticks * cycles_per_tick;
+
+            // the fallback until an emc::recalibration runs on a timer wheel
+            if (!emc::recalibration_scheduled())
+            {
+                ddr_calibration_counter += ticks;
+                if (ddr_calibration_counter >= 1000) // once every second
+                {
+                    emc::start_calibration_cycle();
+                    ddr_calibration_counter = 0;
+                }
+            }
+
+            ctl_time_increment = ticks;
+            ctl_increment_tick_from_isr();
+            ctl_time_increment = 1;
         }
 
-        ++ddr_calibration_counter;
+        program_next_tick(1);
+    }
 
-        ctl_increment_tick_from_isr();
-        // Clear match interrupt
-        T1IR |= 0x1;
+    // earliest timeout of all the tasks waiting on a timer, in ticks from now. 0 when no task waits on a timer.
+    static u32 earliest_ctl_timeout()
+    {
+        u32 earliest = 0;
+        for (CTL_TASK_t* task = ctl_task_list; task; task = task->next)
+        {
+            if (!(task->state & CTL_STATE_TIMER_WAIT))
+                continue;
+            s32 remaining = static_cast<s32>(task->timeout - ctl_current_time);
+            if (remaining < 1)
+                remaining = 1; // already due, the next tick wakes it
+            if (!earliest || static_cast<u32>(remaining) < earliest)
+                earliest = remaining;
+        }
+        return earliest;
+    }
+
+    void ctl_tickless_idle()
+    {
+        int enabled = ctl_global_interrupts_disable(); // a task woken between the scan and the sleep would otherwise wait for our long match
+
+        u32 ticks = earliest_ctl_timeout();
+        u32 max_ticks = max_sleep_cycles / cycles_per_tick;
+        if (!ticks || ticks > max_ticks)
+            ticks = max_ticks;
+
+        if (ticks > 1) // a single tick away, the periodic match is already right
+            program_next_tick(ticks);
+
+        cp15_wait_for_interrupt(); // any interrupt wakes us, masked or not
+
+        // woken by another source long before the match, that interrupt may have readied a task whose timeouts count on the tick again :
+        // go back to the next tick boundary. the timer interrupt reports the ticks slept through.
+        program_next_tick(1);
+
+        ctl_global_interrupts_set(enabled);
     }
     
     void init_ctl_timer(u32 periph_clock, u8 int_priority)
@@ -82,10 +188,12 @@ namespace standard_timer
         T1PC = 0;
     
         // Generate match after configured delay
-        T1MR0 = periph_clock / ctl_get_ticks_per_second();
+        cycles_per_tick = periph_clock / ctl_get_ticks_per_second();
+        last_tick_count = 0;
+        T1MR0 = cycles_per_tick;
 
-        // Interrupt and reset on match reg 0
-        T1MCR |= 0x3;
+        // Interrupt on match reg 0, the counter runs free
+        T1MCR = (T1MCR & ~0x7) | 0x1;
 
         get_int_ctrl().install_service_routine(interrupt::id::timer_1, int_priority, false, interrupt::trigger::low_level, ctl_timer_isr);
         get_int_ctrl().enable_interrupt(interrupt::id::timer_1);
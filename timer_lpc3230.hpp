@@ -4,6 +4,7 @@
 #include "registers_lpc3230.hpp"
 #include "clock_lpc3230.hpp"
 #include "timer_client.hpp"
+#include <ctl_api.h>
 #include "modules/init/globals.hpp"
 
 namespace lpc3230
@@ -13,52 +14,79 @@ namespace standard_timer
 {
     void timer_0_wait(u32 periph_clock, u32 ms) __attribute__ ((section (".reset")));
 
+    // free-running count of timer 0 at periph_clock, to measure durations before the scheduler and the high speed timer run.
+    // in .reset like timer_0_wait : the DQS delay search calls them while the DDR is not trustworthy yet
+    void timer_0_start_count() __attribute__ ((section (".reset")));
+    u32 timer_0_get_count() __attribute__ ((section (".reset")));
+    void timer_0_stop_count() __attribute__ ((section (".reset")));
+
     void init_ctl_timer(u32 periph_clock, u8 int_priority);
+    // call from the idle task loop : sleeps until the earliest CTL timeout (or any other interrupt) instead of waking on every tick.
+    // nothing calls it for you : the application makes it the body of the loop main() ends in, once it became the lowest priority task
+    //   ctl_task_set_priority(&main_task, 0);
+    //   for (;;)
+    //       standard_timer::ctl_tickless_idle();
+    // needs init_ctl_timer to have run, and timer 1 left to the CTL tick. only the idle task may call it, never an interrupt handler :
+    // it sleeps whenever it runs, which is only safe when no other task is ready.
+    void ctl_tickless_idle();
     void init_ddr_recalibrate_timer(u32 periph_clock, u8 int_priority);
 
     template <u8 TimerID>
     class timer
     {
     public:
+        timer() : client(0), delay_installed(false)
+        {
+            ctl_events_init(&delay_event, 0);
+            ctl_mutex_init(&delay_mutex);
+        }
+
+        // busy-waits on the match flag before init_delay or the scheduler, sleeps like delay() once a task may sleep on the timer.
         void wait(u32 ms)
         {
-            // Power timer
-            regs.power = 1;
-        
-            // Reset counter and disable it
-            regs.counter_enable = 0;
-            regs.counter_reset = 1;
-            regs.counter_reset = 0;
-        
-            // Clear match interrupt
-            regs.match_channel_0 = 1;
-        
-            // Count mode positive clock edge
-            regs.counter_timer_mode = 0;
-        
-            // No prescaler
-            regs.prescaler = 0;
-        
-            // Generate match after x ms
-            regs.match_0 = get_hw_clock().get_periph_freq() / 1000 * ms;
-        
-            // Interrupt on match reg 0
-            regs.int_on_match_0 = 1;
-        
-            // Enable the counter
-            regs.counter_enable = 1;
-        
-            // Wait for the interrupt flag (polling instead of int handling)
-            while (!regs.match_channel_0);
-        
-            // Disable the timer
-            regs.counter_enable = 0;
-        
-            // Disable power to timer
-            regs.power = 0;
+            if (delay_installed && ctl_task_executing && !ctl_interrupt_count)
+                delay(ms * 1000);
+            else
+                spin(get_hw_clock().get_periph_freq() / 1000 * ms);
+        }
+
+        // installs the match interrupt used to wake the tasks sleeping in delay(). a timer used for delays cannot serve a timer_client.
+        void init_delay(u8 priority, bool fast_irq = false)
+        {
+            client = 0;
+            get_int_ctrl().install_service_routine(interrupt_id, priority, fast_irq, interrupt::trigger::low_level, interrupt::member_thunk<timer, &timer::isr>, this);
+            get_int_ctrl().enable_interrupt(interrupt_id);
+            delay_installed = true;
+        }
+
+        // puts the calling task to sleep for at least usec microseconds, other tasks get the CPU meanwhile. tasks sharing the timer take turns.
+        // spins instead when the caller cannot sleep : before init_delay, before the scheduler starts, or from an interrupt handler.
+        void delay(u32 usec)
+        {
+            u64 temp_match = static_cast<u64>(get_hw_clock().get_periph_freq()) * static_cast<u64>(usec);
+            u32 cycles = static_cast<u32>(temp_match / 1000000);
+
+            if (!delay_installed || !ctl_task_executing || ctl_interrupt_count)
+            {
+                spin(cycles);
+                return;
+            }
+
+            // the match interrupt wakes us well before this. the timeout only keeps a lost interrupt from hanging the task
+            u32 timeout = static_cast<u32>(static_cast<u64>(ctl_get_ticks_per_second()) * usec / 1000000) + 2;
+
+            ctl_mutex_lock(&delay_mutex, CTL_TIMEOUT_NONE, 0);
+            ctl_events_set_clear(&delay_event, 0, 1);
+
+            start_match(cycles);
+            ctl_events_wait(CTL_EVENT_WAIT_ANY_EVENTS_WITH_AUTO_CLEAR, &delay_event, 1, CTL_TIMEOUT_DELAY, timeout);
+            stop();
+
+            ctl_mutex_unlock(&delay_mutex);
         }
 
-        void set_isr(u8 priority, bool fast_irq, timer_client& c, u32 usec_timeout = 0)
+        // one-shot by default : the counter stops on match until trigger_isr restarts it. periodic timers reset on match and keep counting.
+        void set_isr(u8 priority, bool fast_irq, timer_client& c, u32 usec_timeout = 0, bool periodic = false)
         {
             // Generate match after x us
             regs.power = 1;
@@ -79,15 +107,17 @@ namespace standard_timer
         
             // Clear match after configured delay
             u64 temp_match = static_cast<u64>(get_hw_clock().get_periph_freq()) * static_cast<u64>(usec_timeout);
-            regs.match_0 = static_cast<u32>(temp_match / 1000000);
+            regs.match_0 = static_cast<u32>(temp_match / 1000000) - (periodic ? 1 : 0); // resetting on match counts match_0 + 1 cycles per period
     
-            // Interrupt and stop on match reg 0
+            // Interrupt and stop (or reset) on match reg 0
             regs.int_on_match_0 = 1;
-            regs.stop_on_match_0 = 1;
+            regs.stop_on_match_0 = !periodic;
+            regs.reset_on_match_0 = periodic;
 
             // Enable interrupt
             client = &c;
-            get_int_ctrl().install_service_routine(interrupt_id, priority, fast_irq, interrupt::trigger::low_level, static_isr);
+            delay_installed = false;
+            get_int_ctrl().install_service_routine(interrupt_id, priority, fast_irq, interrupt::trigger::low_level, interrupt::member_thunk<timer, &timer::isr>, this);
             get_int_ctrl().enable_interrupt(interrupt_id);
         }
 
@@ -112,16 +142,92 @@ namespace standard_timer
         }
 
     private:
-        static void static_isr()
+        void isr()
+        {
+            if (client)
+                client->timer_isr();
+            else
+                ctl_events_set_clear(&delay_event, 1, 0); // wake the task in delay()
+            regs.match_channel_0 = 1;
+        }
+
+        // one-shot match after the given number of periph_clock cycles
+        void start_match(u32 cycles)
+        {
+            // Power timer
+            regs.power = 1;
+        
+            // Reset counter and disable it
+            regs.counter_enable = 0;
+            regs.counter_reset = 1;
+            regs.counter_reset = 0;
+        
+            // Clear match interrupt
+            regs.match_channel_0 = 1;
+        
+            // Count mode positive clock edge
+            regs.counter_timer_mode = 0;
+        
+            // No prescaler
+            regs.prescaler = 0;
+        
+            // Generate match after the delay. a match on 0 would never come, the counter is already past it when enabled
+            regs.match_0 = cycles ? cycles : 1;
+        
+            // Interrupt and stop on match reg 0
+            regs.int_on_match_0 = 1;
+            regs.stop_on_match_0 = 1;
+            regs.reset_on_match_0 = 0;
+        
+            // Enable the counter
+            regs.counter_enable = 1;
+        }
+
+        void stop()
+        {
+            // Disable the timer
+            regs.counter_enable = 0;
+        
+            // Disable power to timer
+            regs.power = 0;
+        }
+
+        void spin(u32 cycles)
         {
-            timer<TimerID>& this_timer = get_timer< timer<TimerID> >();
-            this_timer.client->timer_isr();
-            this_timer.regs.match_channel_0 = 1;
+            // a task may be sleeping in delay() : restarting and stopping the timer would take its match away.
+            // count on the free-running high speed timer instead, it runs at periph_clock too
+            if (delay_installed && ctl_task_executing)
+            {
+                u32 start = clock::controller::get_cycles();
+                while (clock::controller::cycles_since(start) < cycles);
+                return;
+            }
+
+            // the delay interrupt would clear the flag under our feet
+            if (delay_installed)
+                get_int_ctrl().disable_interrupt(interrupt_id);
+
+            start_match(cycles);
+        
+            // Wait for the interrupt flag (polling instead of int handling)
+            while (!regs.match_channel_0);
+
+            stop();
+
+            if (delay_installed)
+            {
+                regs.match_channel_0 = 1;
+                get_int_ctrl().enable_interrupt(interrupt_id);
+            }
         }
 
         reg_specific<TimerID> regs;
         static const interrupt::id::en interrupt_id = (TimerID == 0) ? interrupt::id::timer_0 : (TimerID == 1) ? interrupt::id::timer_1 : interrupt::id::timer_2;
         timer_client* client;
+
+        bool delay_installed;
+        CTL_EVENT_SET_t delay_event;
+        CTL_MUTEX_t delay_mutex;
     };
 
 }
@@ -0,0 +1,182 @@
+#pragma once
+
+#include "armtastic/types.hpp"
+#include "timer_lpc3230.hpp"
+#include "timer_client.hpp"
+#include <ctl_api.h>
+
+namespace lpc3230
+{
+
+namespace software_timer
+{
+    typedef void (*expiry_callback)(void* context);
+
+    // storage for a software timer belongs to its user. it must stay in place, and not be reused, while armed.
+    struct timer
+    {
+        timer() : next(0), pprev(0), expires(0), period(0), routine(0), context(0) {}
+
+        bool armed() const { return pprev != 0; }
+
+        timer* next;
+        timer** pprev; // points to whatever points to us, so we can unlink without walking the list
+        u32 expires; // in wheel ticks
+        u32 period; // 0 for one-shot timers
+        expiry_callback routine;
+        void* context;
+    };
+
+    // hierarchical timer wheel driven by the periodic match interrupt of a single standard timer.
+    // start and cancel are O(1) whatever the number of armed timers. a timer lands in the slot matching the tick
+    // it expires on if that tick is less than 64 ticks away, otherwise in a coarser level, and is cascaded down as its deadline gets closer.
+    // expiry callbacks run from the timer interrupt : keep them short, or push the work to a deferred call.
+    class wheel : public timer_client
+    {
+    public:
+        wheel() : now(0), tick_usec(0) {}
+
+        template <u8 TimerID>
+        void init(standard_timer::timer<TimerID>& hardware, u8 priority, bool fast_irq, u32 usec_per_tick)
+        {
+            now = 0;
+            tick_usec = usec_per_tick;
+            for (u8 l = 0; l < levels; ++l)
+                for (u8 s = 0; s < slots; ++s)
+                    wheels[l][s] = 0;
+
+            hardware.set_isr(priority, fast_irq, *this, usec_per_tick, true);
+            hardware.trigger_isr(); // start counting
+        }
+
+        // arm t to expire in delay ticks (at least 1), then every period ticks if period is not 0. restarting an armed timer moves it.
+        void start(timer& t, u32 delay, u32 period, expiry_callback routine, void* context)
+        {
+            int enabled = ctl_global_interrupts_disable();
+            if (t.armed())
+                unlink(t);
+            t.expires = now + ((delay > 0) ? delay : 1);
+            t.period = period;
+            t.routine = routine;
+            t.context = context;
+            insert(t);
+            ctl_global_interrupts_set(enabled);
+        }
+
+        void cancel(timer& t)
+        {
+            int enabled = ctl_global_interrupts_disable();
+            if (t.armed())
+                unlink(t);
+            ctl_global_interrupts_set(enabled);
+        }
+
+        u32 get_ticks() { return now; }
+        u32 get_tick_usec() { return tick_usec; }
+
+        u32 ms_to_ticks(u32 ms)
+        {
+            return (ms * 1000 + tick_usec - 1) / tick_usec; // round up, a deadline must never come early
+        }
+
+        virtual void timer_isr()
+        {
+            ++now;
+
+            // when a level wraps, bring the next slot of the coarser level down
+            u32 index = now & slot_mask;
+            for (u8 l = 1; l < levels && 0 == index; ++l)
+            {
+                index = (now >> (l * slot_bits)) & slot_mask;
+                cascade(wheels[l][index]);
+            }
+
+            expire(wheels[0][now & slot_mask]);
+        }
+
+    private:
+        void insert(timer& t)
+        {
+            u32 delta = t.expires - now;
+            u32 expires = t.expires;
+            u8 level = 0;
+
+            if (delta >= max_delta) // farther than the wheel reaches : park it in the last level, it will be reinserted when cascaded
+                expires = now + max_delta - 1;
+
+            while (level < levels - 1 && delta >= (1u << ((level + 1) * slot_bits)))
+                ++level;
+
+            link(t, wheels[level][(expires >> (level * slot_bits)) & slot_mask]);
+        }
+
+        void link(timer& t, timer*& head)
+        {
+            t.next = head;
+            if (head)
+                head->pprev = &t.next;
+            head = &t;
+            t.pprev = &head;
+        }
+
+        void unlink(timer& t)
+        {
+            *t.pprev = t.next;
+            if (t.next)
+                t.next->pprev = t.pprev;
+            t.next = 0;
+            t.pprev = 0;
+        }
+
+        void cascade(timer*& head)
+        {
+            while (head)
+            {
+                timer& t = *head;
+                unlink(t);
+                insert(t);
+            }
+        }
+
+        void expire(timer*& head)
+        {
+            // detach the slot first : callbacks may start or cancel any timer, including the ones still waiting in this list
+            timer* pending = 0;
+            while (head)
+            {
+                timer& t = *head;
+                unlink(t);
+                link(t, pending);
+            }
+
+            while (pending)
+            {
+                timer& t = *pending;
+                unlink(t);
+                if (t.expires != now) // a far timer parked in a nearer slot than its deadline
+                {
+                    insert(t);
+                    continue;
+                }
+                if (t.period)
+                {
+                    t.expires += t.period;
+                    insert(t);
+                }
+                t.routine(t.context);
+            }
+        }
+
+        static const u8 levels = 4;
+        static const u8 slot_bits = 6;
+        static const u8 slots = 1 << slot_bits;
+        static const u32 slot_mask = slots - 1;
+        static const u32 max_delta = 1u << (levels * slot_bits);
+
+        volatile u32 now;
+        u32 tick_usec;
+        timer* wheels[levels][slots];
+    };
+}
+
+}
\ No newline at end of file
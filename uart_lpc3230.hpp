@@ -4,6 +4,7 @@
 #include "clock_lpc3230.hpp"
 #include "interrupt_lpc3230.hpp"
 #include "uart_client.hpp"
+#include "clock_client.hpp"
 #include "modules/init/globals.hpp"
 
 namespace lpc3230
@@ -42,10 +43,10 @@ namespace standard_uart
     }
 
     template <u8 UartID>
-    class uart
+    class uart : public clock_client
     {
     public:
-        uart() : client(0), max_throughput(0)
+        uart() : client(0), max_throughput(0), baud(0), divider_freq(0)
         {}
 
         // initialization sequence not in constructor since global uart settings and clock may not be initialized when the object is created statically
@@ -73,11 +74,12 @@ namespace standard_uart
             regs.word_length_select_field = length;
 
             set_baud_rate(baud_rate);
+            get_hw_clock().add_client(*this);
 
             u32 temp;
             get_and_clear_stats(temp, temp, temp);
 
-            get_int_ctrl().install_service_routine(interrupt_id, priority, fast_irq, interrupt::trigger::high_level, static_isr); // must be tested for the type of trigger
+            get_int_ctrl().install_service_routine(interrupt_id, priority, fast_irq, interrupt::trigger::high_level, interrupt::member_thunk<uart, &uart::isr>, this); // must be tested for the type of trigger
             get_int_ctrl().enable_interrupt(interrupt_id);
 
             if (client)
@@ -91,6 +93,8 @@ namespace standard_uart
         void set_baud_rate(u32 baud_rate)
         {
             u8 x, y;
+            baud = baud_rate;
+            divider_freq = get_hw_clock().get_periph_freq();
             compute_x_y_divider(baud_rate, x, y);
             regs.clock_source_field = 0; // use periph_clock. if we ever go into Direct RUN mode, this clock will still exist, we won't need to reprogram a new divider based on periph_clock.
             regs.x_divider_field = x;
@@ -127,6 +131,13 @@ namespace standard_uart
 
         bool write_fifo_empty() {return (0 == (regs.line_status & 0x40));}
 
+        // clocked from periph_clock, which frequency changes normally leave alone
+        virtual void frequency_changed(const clock::frequencies& current)
+        {
+            if (current.periph != divider_freq)
+                set_baud_rate(baud);
+        }
+
     private:
         u8 write_avail_bytes(bool from_interrupt = true)
         {
@@ -193,11 +204,6 @@ namespace standard_uart
             }
         }
 
-        static void static_isr()
-        {
-            get_uart< uart<UartID> >().isr();
-        }
-
         void isr()
         {
             enum interrupt_sources
@@ -294,6 +300,8 @@ namespace standard_uart
         static const u32 receive_fifo_size = 64;
 
         u32 max_throughput; // Bytes per second
+        u32 baud;
+        u32 divider_freq; // periph_clock frequency the divider was computed for
 
         u32 sent_bytes_accumulator;
         u32 received_bytes_accumulator;
@@ -312,21 +320,18 @@ namespace high_speed_uart
     // set the trigger level very low (setting 0 : 1 byte), put the uart in loopback, send a byte or enough to cross the trigger, then read that data back. Then remove the uart from loopback mode.
 
     template <u8 UartID>
-    class uart
+    class uart : public clock_client
     {
     public:
-        uart() : client(0), max_throughput(0), clear_to_send(0)
+        uart() : client(0), max_throughput(0), baud(0), divider_freq(0), clear_to_send(0)
         {}
 
         // initialization sequence not in constructor since global uart settings and clock may not be initialized when the object is created statically
         void init(u8 priority, bool fast_irq, u32 baud_rate, bool enable_cts = false)
         {
             // OPTIMIZATION_TODO : the 3 high-speed UARTs support DMA. Switch to DMA when a basic driver will work properly. Create a new driver for the DMA version.
-            u8 div;
-            compute_divider(baud_rate, div);
-            regs.rate_control = div;
-
-            compute_max_throughput(baud_rate);
+            set_baud_rate(baud_rate);
+            get_hw_clock().add_client(*this);
 
             if (enable_cts)
                 regs.cts_flow_control_field = true;
@@ -337,7 +342,7 @@ namespace high_speed_uart
             u32 temp;
             get_and_clear_stats(temp, temp, temp);
 
-            get_int_ctrl().install_service_routine(interrupt_id, priority, fast_irq, interrupt::trigger::high_level, static_isr);
+            get_int_ctrl().install_service_routine(interrupt_id, priority, fast_irq, interrupt::trigger::high_level, interrupt::member_thunk<uart, &uart::isr>, this);
             get_int_ctrl().enable_interrupt(interrupt_id);
 
             if (client)
@@ -417,6 +422,24 @@ namespace high_speed_uart
 
         bool write_fifo_empty() {return (0 == regs.tx_level_field);}
 
+        void set_baud_rate(u32 baud_rate)
+        {
+            u8 div;
+            baud = baud_rate;
+            divider_freq = get_hw_clock().get_periph_freq();
+            compute_divider(baud_rate, div);
+            regs.rate_control = div;
+
+            compute_max_throughput(baud_rate);
+        }
+
+        // clocked from periph_clock, which frequency changes normally leave alone
+        virtual void frequency_changed(const clock::frequencies& current)
+        {
+            if (current.periph != divider_freq)
+                set_baud_rate(baud);
+        }
+
     private:
         void write_avail_bytes()
         {
@@ -464,11 +487,6 @@ namespace high_speed_uart
             return space_available;
         }
 
-        static void static_isr()
-        {
-            get_uart< uart<UartID> >().isr();
-        }
-
         void isr()
         {
             u8 int_id = regs.interrupt_id;
@@ -538,6 +556,8 @@ namespace high_speed_uart
         static const u32 receive_fifo_size = 64;
 
         u32 max_throughput; // Bytes per second
+        u32 baud;
+        u32 divider_freq; // periph_clock frequency the divider was computed for
 
         bool (*clear_to_send)(); // Clear to send indicator
 